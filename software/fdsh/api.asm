@@ -0,0 +1,112 @@
+; Flash Disk Shell
+; Copyright (c) 2025 Arvid Juskaitis
+
+; Split-phase requests for programs, entry points are in the jump table at $8003.
+; A request is sent and left to the MCU, which looks the file up and reads its first page while the
+; program goes on, data is pumped later, a few bytes per call. The request is taken from buffer+2 as
+; from the command line: name, #block or @index, '#xxxx' hex arguments, 0 terminated, prefix is prepended.
+; Data goes to (ptr), which moves past it. CMD_READ streams FileEntry (32 bytes) ahead of data.
+
+; fd_request - A: CMD_READ, CMD_READ_RANGE, CMD_READ_NEXT or CMD_OPEN
+; if C=1, request is not taken, A contains status. ptr is kept, it may be set before the request
+fd_request:
+    tax
+    lda ptr+1               ; arguments are parsed into ptr
+    pha
+    lda ptr
+    pha
+    txa
+    jsr send_request_begin
+    tax
+    pla
+    sta ptr
+    pla
+    sta ptr+1
+    txa
+    bcs fd_request_done
+    lda #FD_REPLY
+    sta fd_state
+    lda #ST_WIP
+fd_request_done:
+    rts
+
+; fd_pump - up to X bytes into (ptr), 0 - 256. Returns at once while the MCU works on the request
+; A=ST_WIP, C=0 - more may follow, ptr tells how much is received
+; A=ST_DONE - transfer is over, C=0 if final status is ACK, e.g. CRC matches
+; A=ST_DONE, C=1 - file not found, request declined or CRC mismatch; A=ST_ERROR, C=1 - timeout
+; A=ST_RESET, C=1 - nothing is requested
+fd_pump:
+    stx fd_count
+    lda fd_state
+    cmp #FD_DATA
+    beq fd_pump_byte
+    cmp #FD_REPLY
+    bne fd_pump_idle
+    lda DEVICE_IN           ; reply is valid only if RDY is set
+    bmi fd_pump_reply
+    lda #ST_WIP
+    clc
+    rts
+fd_pump_reply:
+    cmp #BODT
+    bne fd_pump_declined    ; EODT or NACK
+    jsr send_ack
+    lda #FD_DATA
+    sta fd_state
+fd_pump_byte:
+    jsr receive_data_byte
+    bcs fd_pump_end
+    ldy #$00
+    sta (ptr),y
+    inc ptr
+    bne fd_pump_next
+    inc ptr+1
+fd_pump_next:
+    dec fd_count
+    bne fd_pump_byte
+    lda #ST_WIP
+    clc
+    rts
+fd_pump_end:
+    cmp #ST_DONE
+    bne fd_pump_failed      ; timeout
+    jsr receive_byte        ; final status follows EODT
+    bcs fd_pump_failed
+    cmp #ACK
+    bne fd_pump_declined
+    lda #FD_IDLE
+    sta fd_state
+    lda #ST_DONE
+    clc
+    rts
+fd_pump_declined:
+    lda #ST_DONE
+    bne fd_pump_stop        ; always
+fd_pump_failed:
+    lda #ST_ERROR
+fd_pump_stop:
+    ldx #FD_IDLE
+    stx fd_state
+    ldx #0                  ; the last listing could be stale
+    stx dir_count
+fd_pump_idle:               ; nothing is requested
+    sec
+    rts
+
+; fd_ready - C=1 once the MCU has the reply or the next byte, fd_pump would not wait for it
+fd_ready:
+    lda DEVICE_IN
+    asl                     ; RDY into C
+    rts
+
+; fd_abort - drop the request or the rest of data, MCU resets on NACK. If C=1, NACK is not taken
+fd_abort:
+    clc
+    lda fd_state
+    beq fd_abort_done
+    lda #NACK
+    jsr send_byte
+    lda #FD_IDLE
+    sta fd_state
+fd_abort_done:
+    rts
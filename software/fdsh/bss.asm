@@ -4,8 +4,11 @@
 ; Zero-Page variables
 *   = $00
 buffer:             .fill 32        ; command / FileEntry
-buff_fe_start = buffer+2    
-buff_fe_size = buffer+4
+buff_fe_flags = buffer+3
+buff_fe_start = buffer+8
+buff_fe_size = buffer+10
+buff_fe_xsize = buffer+12
+buff_fe_name = buffer+14
 prg_start:          .addr ?         ; write, jmp_prg
 prg_stop:           .addr ?         ; calculated address
 
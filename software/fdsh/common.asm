@@ -1,7 +1,7 @@
 ; Flash Disk Shell
 ; Copyright (c) 2025 Arvid Juskaitis
 
-; ptr has to be set befor enter this
+; ptr has to be set befor enter this, messages may be longer than a page
 print_msg:
     ldy #0
 print_msg_loop:
@@ -9,6 +9,8 @@ print_msg_loop:
     beq print_msg_done
     jsr ECHO
     iny
+    bne print_msg_loop
+    inc ptr+1           ; next page
     jmp print_msg_loop
 print_msg_done:
     rts
@@ -47,6 +49,19 @@ invalid_hex:
     lda #$00            ; return 0 if invalid
     rts
 
+; replace size with expanded size if file is compressed
+use_expanded_size:
+    lda buff_fe_flags
+    and #FE_LZ
+    cmp #FE_LZ
+    bne use_expanded_size_done
+    lda buff_fe_xsize
+    sta buff_fe_size
+    lda buff_fe_xsize+1
+    sta buff_fe_size+1
+use_expanded_size_done:
+    rts
+
 ; sum addresses
 calc_prg_stop:
     clc
@@ -184,6 +199,65 @@ send_data_byte_err:
     pla
     rts
 
+; CMD_WRITE_BLOCK data byte from A, MCU takes nibbles in ISR, ACKF tells they are taken
+; if C=1, timeout
+send_block_byte:
+    jsr send_block_ms
+    bcs send_block_byte_done
+    and #$0F            ; LS nibble
+    ora #DAT
+    sta DEVICE_OUT
+    ldy #$ff
+send_block_ls_wait:
+    lda DEVICE_IN
+    and #BSY|ACKF
+    cmp #ACKF           ; byte is taken
+    beq send_block_byte_ok
+    dey
+    bne send_block_ls_wait
+    sec
+send_block_byte_done:
+    rts
+send_block_byte_ok:
+    clc
+    rts
+
+; send MS nibble of A, preserve A. if C=1, timeout
+send_block_ms:
+    pha
+    lsr
+    lsr
+    lsr
+    lsr
+    ora #DAT
+    sta DEVICE_OUT
+    ldy #$ff
+send_block_ms_wait:
+    lda DEVICE_IN
+    and #BSY|ACKF       ; both clear once MS nibble is taken
+    beq send_block_ms_done
+    dey
+    bne send_block_ms_wait
+    pla
+    sec
+    rts
+send_block_ms_done:
+    pla
+    clc
+    rts
+
+; send page sum from A, MCU stays busy while it programs the page
+; if C=0, A is ACK or NACK if the sum does not match. if C=1, timeout
+send_block_sum:
+    jsr send_block_ms
+    bcs send_block_sum_done
+    and #$0F
+    ora #DAT
+    sta DEVICE_OUT
+    jsr receive_status
+send_block_sum_done:
+    rts
+
 ; send ACK, preserve A
 send_ack:
     pha
@@ -193,59 +267,211 @@ send_ack:
     rts
 
 ; ------------------------------------------------------------------------
-; send request to device
-; at this point A must contain the command and argument is stored in the buffer 
-; if C=1, A contains status
-send_request:
-    jsr send_byte
-    bcs send_request_err    ; timeout
-    jsr receive_byte        ; ACK is expected
-    bcs send_request_err    ; timeout
-    cmp #NACK
-    beq send_request_done
+; cut addr off command line 'name#offs#len#addr' into prg_start, prg_stop = addr + len
+; if C=1, command line is invalid
+parse_range_args:
+    ldx #2
+parse_range_eos:                ; find end of the string
+    lda buffer, x
+    beq parse_range_addr
+    inx
+    bne parse_range_eos
+parse_range_addr:
+    jsr parse_range_hash
+    bcs parse_range_done        ; no address given
+    lda #0
+    sta buffer, x               ; terminate request before address
+    txa
+    pha
+    inx
+    jsr parse_addr              ; address into ptr
+    lda ptr
+    sta prg_start
+    lda ptr+1
+    sta prg_start+1
+    pla
+    tax
+    jsr parse_range_hash
+    bcs parse_range_done        ; no length given
+    inx
+    jsr parse_addr              ; length into ptr
+    clc
+    lda prg_start
+    adc ptr
+    sta prg_stop
+    lda prg_start+1
+    adc ptr+1
+    sta prg_stop+1
+    clc
+parse_range_done:
+    rts
 
-    lda #BODT
-    jsr send_byte
-    bcs send_request_err    ; timeout
-    jsr receive_byte        ; ACK is expected
-    bcs send_request_err    ; timeout
-    cmp #NACK
-    beq send_request_done
+; move x back to the previous '#', C=1 if there is none after the name
+parse_range_hash:
+    dex
+    cpx #2
+    beq parse_range_hash_err
+    lda buffer, x
+    cmp #'#'
+    bne parse_range_hash
+    clc
+    rts
+parse_range_hash_err:
+    sec
+    rts
+
+; Parse decimal value into (ptr, ptr+1). x points to the first digit in buffer, stops at non-digit
+parse_dec:
+    lda #$00
+    sta ptr
+    sta ptr+1
+parse_dec_loop:
+    lda buffer, x
+    sec
+    sbc #'0'
+    bcc parse_dec_done      ; '#' or null terminator
+    cmp #10
+    bcs parse_dec_done
+    pha                     ; digit
+    asl ptr                 ; ptr * 2
+    rol ptr+1
+    lda ptr
+    ldy ptr+1
+    asl ptr                 ; ptr * 8
+    rol ptr+1
+    asl ptr
+    rol ptr+1
+    clc                     ; ptr * 8 + ptr * 2
+    adc ptr
+    sta ptr
+    tya
+    adc ptr+1
+    sta ptr+1
+    pla                     ; add digit
+    clc
+    adc ptr
+    sta ptr
+    bcc parse_dec_next
+    inc ptr+1
+parse_dec_next:
+    inx
+    bne parse_dec_loop      ; always
+parse_dec_done:
+    rts
 
-    ; send prefix if any
+; wait for status byte, MCU stays busy while it completes the command, e.g. erases flash
+; if C=1, timeout
+receive_status:
+    ldx #16
+receive_status_loop:
+    jsr receive_byte
+    bcc receive_status_done
+    dex
+    bne receive_status_loop
+receive_status_done:
+    rts
+
+; ------------------------------------------------------------------------
+; request is binary: name length, prefix and name, or 0 and block number (decimal on command line),
+; then every '#xxxx' hex value of the command line as 16-bit little endian. Handle is sent as a block
+; if C=1, timeout
+send_request_header:
     ldx #2
     lda buffer, x
     cmp #'#'                ; block id start
-    beq send_request_args   ; don't prefix block id
+    beq send_request_block  ; don't prefix block id
+    cmp #'@'                ; index of the last listing, resolved into dir_block
+    beq send_request_block
+    ldy #0                  ; count prefix and name
     ldx #0
+send_request_prefix_len:
     lda prefix, x
-    beq send_request_args   ; empty prefix
+    beq send_request_name_len_start
+    iny
+    inx
+    bne send_request_prefix_len
+send_request_name_len_start:
+    ldx #2
+send_request_name_len:
+    lda buffer, x
+    beq send_request_name_len_done
+    cmp #'#'
+    beq send_request_name_len_done
+    iny
+    inx
+    bne send_request_name_len
+send_request_name_len_done:
+    tya
+    jsr send_data_byte
+    bcs send_request_header_done
+    ldx #0
 send_request_prefix:
     lda prefix, x
-    beq send_request_args
+    beq send_request_name_start
     jsr send_data_byte
-    bcs send_request_err    ; timeout
+    bcs send_request_header_done
     inx
-    jmp send_request_prefix;
-
-    ; send argument from buffer[2]
-send_request_args:
+    jmp send_request_prefix
+send_request_name_start:
     ldx #2
-send_request_arg:
+send_request_name:
     lda buffer, x
-    beq send_request_eodt
+    beq send_request_header_ok
+    cmp #'#'
+    beq send_request_args
     jsr send_data_byte
-    bcs send_request_err    ; timeout
+    bcs send_request_header_done
+    inx
+    jmp send_request_name
+send_request_block:
+    lda #0                  ; no name, block number follows
+    jsr send_data_byte
+    bcs send_request_header_done
     inx
-    jmp send_request_arg;
+    jsr parse_dec           ; block into ptr
+    lda buffer+2
+    cmp #'@'
+    bne send_request_block_ptr
+    lda dir_block
+    sta ptr
+    lda dir_block+1
+    sta ptr+1
+send_request_block_ptr:
+    jsr send_ptr
+    bcs send_request_header_done
+send_request_args:          ; x points to '#' or null
+    lda buffer, x
+    cmp #'#'
+    bne send_request_header_ok
+    inx
+    jsr parse_addr          ; hex value into ptr
+    jsr send_ptr
+    bcs send_request_header_done
+    jmp send_request_args
+send_request_header_ok:
+    clc
+send_request_header_done:
+    rts
 
-send_request_eodt:
-    lda #EODT
-    jsr send_byte
-    bcs send_request_err    ; timeout
+; send ptr as 16-bit little endian, C=1 if timeout
+send_ptr:
+    lda ptr
+    jsr send_data_byte
+    bcs send_ptr_done
+    lda ptr+1
+    jsr send_data_byte
+send_ptr_done:
+    rts
+
+; ------------------------------------------------------------------------
+; send request to device
+; at this point A must contain the command and argument is stored in the buffer 
+; if C=1, A contains status
+send_request:
+    jsr send_request_begin
+    bcs send_request_end
 .if REAL_HW
-    jsr delay_long
-    jsr receive_byte        ; ACK. BODT or EODT is expected
+    jsr receive_status      ; ACK. BODT or EODT is expected, MCU is busy while it processes request
     bcs send_request_err    ; timeout
     cmp #NACK
     beq send_request_done
@@ -257,11 +483,49 @@ send_request_eodt:
     jsr send_ack            ; ACK
 send_no_ack:
     clc                     ; success
+send_request_end:
+    rts
+
+; send command, request and EODT, the reply is not waited for, MCU is busy while it processes request
+; if C=1, A contains status
+send_request_begin:
+    pha
+    jsr dir_resolve         ; '@index' is checked before the device is involved
+    pla
+    bcs send_request_invalid
+    jsr send_byte
+    bcs send_request_err    ; timeout
+    jsr receive_byte        ; ACK is expected
+    bcs send_request_err    ; timeout
+    cmp #NACK
+    beq send_request_done
+
+    lda #BODT
+    jsr send_byte
+    bcs send_request_err    ; timeout
+    jsr receive_byte        ; ACK is expected
+    bcs send_request_err    ; timeout
+    cmp #NACK
+    beq send_request_done
+
+    jsr send_request_header
+    bcs send_request_err    ; timeout
+
+send_request_eodt:
+    lda #EODT
+    jsr send_byte
+    bcs send_request_err    ; timeout
     rts
+; request is declined or the device does not answer, the last listing could be stale
 send_request_done:
+    lda #0
+    sta dir_count
     lda #ST_DONE
     rts
 send_request_err:
+    lda #0
+    sta dir_count
+send_request_invalid:
     lda #ST_ERROR
     rts
 
@@ -15,13 +15,36 @@ CMD_LIST    = $01
 CMD_READ    = $02
 CMD_WRITE   = $03
 CMD_DELETE  = $04
+CMD_READ_RANGE = $05
+CMD_UPDATE  = $06
+CMD_OPEN    = $07
+CMD_READ_NEXT = $08
+CMD_SEEK    = $09
+CMD_CLOSE   = $0A
+CMD_STATS   = $0B
+CMD_WRITE_BLOCK = $0C
 ACK         = $A0
 NACK        = $AF
 BODT        = $80       ; Begin of data transfer marker
 EODT        = $8F       ; End of data transfer marker
 
+; File entry flags
+FE_FLAGS_VALID = $80
+FE_FLAG_LZ  = $02       ; compressed, buff_fe_xsize holds expanded size
+FE_LZ       = FE_FLAGS_VALID | FE_FLAG_LZ
+
+; CMD_LIST record header
+LIST_LZ         = $80   ; compressed, stored size follows size
+LIST_BLOCK16    = $40   ; 2 byte block number, otherwise 1 byte delta
+LIST_NAME_MASK  = $1F   ; name length
+
+; Directory cache, records of the last listing are kept as they are in buffer
+DIR_ENTRIES     = 16
+DIR_ENTRY_SIZE  = 32
+
 RDY         = %10000000
 BSY         = %01000000
+ACKF        = %00100000 ; CMD_WRITE_BLOCK, set once a data byte is taken, cleared by MS nibble
 DAT         = %00010000
 
 ; Status codes as return codes from subroutines
@@ -31,6 +54,11 @@ ST_DONE     = 2
 ST_ABORT    = 3
 ST_ERROR    = 4
 
+; Split-phase request states, see api.asm
+FD_IDLE     = 0
+FD_REPLY    = 1         ; request is sent, MCU is busy with it
+FD_DATA     = 2         ; BODT is taken, data follows
+
 ; ------------------------------
 ; Macro SET_PTR addr
 ; parm1 - buffer
@@ -10,6 +10,11 @@ VERSION = "0.9.9"
 
 *   = $8000
     jmp dfsh
+; Entry points for programs, addresses are fixed, see api.asm
+    jmp fd_request      ; $8003
+    jmp fd_pump         ; $8006
+    jmp fd_ready        ; $8009
+    jmp fd_abort        ; $800C
 
     .include "system.asm" 
     .include "delay.asm" 
@@ -19,6 +24,9 @@ VERSION = "0.9.9"
     .include "read.asm" 
     .include "write.asm" 
     .include "delete.asm" 
+    .include "handle.asm"
+    .include "stats.asm" 
+    .include "api.asm"
 
 dfsh:
     sei             ; Disable interrupts
@@ -31,6 +39,8 @@ dfsh:
     sta dat_mask    ; A bit to test to distinguish between data and ctrl byte
     lda #0
     sta prefix      ; clear prefix buffer
+    sta dir_count   ; directory cache is empty
+    sta fd_state    ; no split-phase request
     lda #$00        ; Default to WozMon
     sta prg_start
     lda #$ff
@@ -65,6 +75,11 @@ menu_input_back:
     beq menu_input
     dex 
     jmp menu_input
+
+; Exit to WozMon
+exit:   
+    jmp $ff00           ; WozMon entry
+
 ; process command
 menu_process:
     lda #0          ; replaece CR with 0
@@ -103,28 +118,56 @@ unknown_cmd:
 do_list:
     jsr list
     jmp menu
+do_list_cache:
+    jsr dir_list
+    jmp menu
 do_read:
     jsr read
     jmp menu
+do_read_range:
+    jsr read_range
+    jmp menu
 do_load:
     jsr load
-    bcs menu
+    bcc do_load_basic
+    jmp menu
+do_load_basic:
     jmp $e2b3           ; BASIC warm entry
 do_write:
     jsr write
-    jmp menu
+    jmp menu_drop_cache
+do_update:
+    jsr update
+    jmp menu_drop_cache
 do_save:
     jsr save
-    jmp menu
+    jmp menu_drop_cache
 do_run:
     jmp (prg_start)     ; address must be set by loading or saving file
 do_remove:
     jsr delete
+    jmp menu_drop_cache
+do_open:
+    jsr open
+    jmp menu
+do_read_next:
+    jsr read_next
+    jmp menu
+do_seek:
+    jsr seek
+    jmp menu
+do_close:
+    jsr close
+    jmp menu
+do_stats:
+    jsr stats
     jmp menu
 
-; Exit to WozMon
-exit:   
-    jmp $ff00           ; WozMon entry
+; Files are allocated or moved, blocks of the last listing could be stale
+menu_drop_cache:
+    lda #0
+    sta dir_count
+    jmp menu
 
 ; Copies up to 12 bytes from buffer+1 to prefix, appends '/' if buffer+2 is not null
 cd_prefix:
@@ -157,12 +200,20 @@ prefix_null_terminate:
 cmd_table:
     .byte 'C', 'D', <cd_prefix, >cd_prefix
     .byte 'L', 'S', <do_list,   >do_list
+    .byte 'L', 'C', <do_list_cache, >do_list_cache
     .byte 'W', 'R', <do_write,  >do_write
     .byte 'R', 'D', <do_read,   >do_read
+    .byte 'R', 'R', <do_read_range, >do_read_range
     .byte 'R', 'N', <do_run,    >do_run
     .byte 'S', 'V', <do_save,   >do_save
+    .byte 'U', 'P', <do_update, >do_update
     .byte 'L', 'D', <do_load,   >do_load
     .byte 'R', 'M', <do_remove, >do_remove
+    .byte 'O', 'P', <do_open,   >do_open
+    .byte 'R', 'H', <do_read_next, >do_read_next
+    .byte 'S', 'K', <do_seek,   >do_seek
+    .byte 'C', 'L', <do_close,  >do_close
+    .byte 'S', 'T', <do_stats,  >do_stats
     .byte 0          ; End of table marker
 
 help:
@@ -170,11 +221,28 @@ help:
     .text "FlashDisk Shell v", VERSION, " by Arvid Juskaitis", 13
     .text "CD     CD[directory]", 13
     .text "List   LS[prefix]", 13
+    .text "Cached LC", 13
     .text "Write  WR<filename>#start#stop", 13
-    .text "Read   RD<filename>|#block", 13
+    .text "Read   RD<filename>|#block|@index", 13
+    .text "Range  RR<filename>|#block#offs#len#addr", 13
     .text "Run    RN", 13
     .text "Save   SV<filename>", 13
-    .text "Load   LD<filename>|#block", 13
-    .text "Remove RM<filename>|#block", 13
+    .text "Update UP<filename>#offs#len#addr", 13
+    .text "Load   LD<filename>|#block|@index", 13
+    .text "Remove RM<filename>|#block|@index", 13
+    .text "Open   OP<filename>|#block|@index", 13
+    .text "Handle RH#handle#len#addr", 13
+    .text "Seek   SK#handle#offs", 13
+    .text "Close  CL#handle", 13
+    .text "Stats  ST", 13
 .endif
     .text 0
+
+; Directory cache, RAM past the code, it is not a part of the image
+dir_count:  .byte ?                             ; records of the last listing
+dir_block:  .addr ?                             ; block of '@index', see dir_resolve
+dir_cache:  .fill DIR_ENTRIES * DIR_ENTRY_SIZE  ; records as they are in buffer
+
+; Split-phase request, see api.asm
+fd_state:   .byte ?                             ; FD_IDLE, FD_REPLY or FD_DATA
+fd_count:   .byte ?                             ; bytes left for fd_pump
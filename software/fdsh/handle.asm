@@ -0,0 +1,56 @@
+; Flash Disk Shell
+; Copyright (c) 2025 Arvid Juskaitis
+
+; Open file handles, read from handle position without directory scans
+
+; open file, command line 'OPname', prints handle number and size
+open:
+    lda #CMD_OPEN
+    jsr send_request
+    bcs open_err            ; not found, no free handle
+    cmp #BODT
+    bne open_err
+    ldx #0
+open_byte:                  ; handle, start, size
+    jsr receive_data_byte
+    bcs open_err
+    sta buffer, x
+    inx
+    cpx #5
+    bne open_byte
+    lda #'#'
+    jsr ECHO
+    lda buffer              ; handle
+    jsr PRBYTE
+    lda #' '
+    jsr ECHO
+    lda buffer+4            ; size high
+    jsr PRBYTE
+    lda buffer+3            ; size low
+    jsr PRBYTE
+    jmp read_prg_eodt       ; EODT and status follow
+open_err:
+    jmp read_err
+
+; read from handle position into memory, command line 'RH#handle#len#addr'
+read_next:
+    jsr parse_range_args
+    bcs open_err            ; invalid command line
+    lda #CMD_READ_NEXT
+    jmp read_range_request
+
+; command line 'SK#handle#offs' or 'CL#handle'
+seek:
+    lda #CMD_SEEK
+    bne handle_request      ; always
+close:
+    lda #CMD_CLOSE
+handle_request:
+    jsr send_request
+    bcc handle_done         ; ACK
+    lda #'!'
+    jsr ECHO
+handle_done:
+    lda #CR
+    jsr ECHO
+    rts
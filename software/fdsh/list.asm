@@ -1,7 +1,10 @@
 ; Flash Disk Shell
 ; Copyright (c) 2025 Arvid Juskaitis
 
-; List directory
+; List directory, records are kept in the directory cache, so files could be addressed by '@index'
+
+; addresses within tmp_buffer
+dir_index   = tmp_buffer+9      ; index printed by list_print_fileentry
 
 list:
     lda #CMD_LIST
@@ -13,38 +16,121 @@ list:
     beq list_err
 list_request_ok:
     cmp #BODT
-    bne list_done           ; nope, no data
+    beq list_begin          ; data follows
+list_done:
+    rts
+list_err:
+    lda #'!'
+    jsr ECHO
+    rts
+list_begin:
+    lda #0                  ; block numbers are deltas from the previous record
+    sta buffer
+    sta buffer+1
+    sta dir_count           ; cache holds this listing only
 
 ; ------------------------------------------------------------------------
-; receive 32 bytes- store in the buffer
-list_fileentry:
+; receive a record: header, block, start, size, [stored size], name
+list_record:
+    jsr list_receive
+    sta buffer+2            ; header, hash is not used while listing
+    and #LIST_BLOCK16
+    beq list_block_delta
+    jsr list_receive        ; 2 byte block number
+    sta buffer
+    jsr list_receive
+    sta buffer+1
+    jmp list_block_done
+list_block_delta:
+    jsr list_receive        ; 1 byte delta
+    clc
+    adc buffer
+    sta buffer
+    bcc list_block_done
+    inc buffer+1
+list_block_done:
+    jsr list_receive
+    sta buff_fe_start
+    jsr list_receive
+    sta buff_fe_start+1
+    jsr list_receive        ; expanded size
+    sta buff_fe_size
+    sta buff_fe_xsize
+    jsr list_receive
+    sta buff_fe_size+1
+    sta buff_fe_xsize+1
+    lda #0
+    sta buff_fe_flags
+    bit buffer+2            ; LIST_LZ is bit 7
+    bpl list_name
+    lda #FE_LZ
+    sta buff_fe_flags
+    jsr list_receive        ; stored size
+    sta buff_fe_size
+    jsr list_receive
+    sta buff_fe_size+1
+list_name:
+    lda buffer+2
+    and #LIST_NAME_MASK
+    sta buffer+2            ; name length
     ldx #0
-list_fileentry_byte:
-    jsr receive_data_byte
-    bcc list_fileentry_store ; ok, continue
-    cmp #ST_DONE
-    beq list_done
-    cmp #ST_ERROR
-    beq list_err
-list_fileentry_store:
-    sta buffer, x
+list_name_char:
+    cpx buffer+2
+    beq list_name_done
+    jsr list_receive
+    sta buff_fe_name, x
     inx
-    cpx #32
-    bne list_fileentry_byte
+    bne list_name_char      ; always
+list_name_done:
+    lda #0
+    sta buff_fe_name, x
+    lda dir_count           ; index of the record, if it is kept
+    sta dir_index
+    jsr dir_store
     ; print and check if user has not canceled
     jsr list_print_fileentry
     jsr KBDIN_NOWAIT        ; 0 in A if no key pressed
-    beq list_fileentry      ; next file entry
-list_done:
+    beq list_record         ; next record
     rts
-list_err:
-    lda #'!'
-    jsr ECHO
+
+; ------------------------------------------------------------------------
+; receive next byte of the record in A, on end of data or error return from list
+list_receive:
+    jsr receive_data_byte
+    bcs list_receive_end
+    rts
+list_receive_end:
+    tax
+    pla                     ; drop return address
+    pla
+    cpx #ST_ERROR
+    bne list_receive_done
+    jmp list_err
+list_receive_done:
     rts
 
 ; ------------------------------------------------------------------------
-; print buffer
+; print buffer, LS and LC share it
 list_print_fileentry:
+; print index for '@index' as decimal, blank if the record is not in the directory cache
+    lda dir_index
+    cmp dir_count
+    bcs list_print_no_index
+    sta uint2str_number
+    lda #0
+    sta uint2str_number+1
+    jsr uint2str
+    ldx #3              ; up to 2 digits
+    jsr list_print_uint2str_buffer
+    jmp list_print_start
+list_print_no_index:
+    lda #' '
+    jsr ECHO
+    lda #' '
+    jsr ECHO
+list_print_start:
+    lda #' '
+    jsr ECHO
 ; print 2 byte start address (offs=2) as hex
     lda buff_fe_start+1 ; start high
     jsr PRBYTE
@@ -56,15 +142,24 @@ list_print_fileentry:
     jsr ECHO
     lda #' '
     jsr ECHO
-; print 2 byte stop address (start address + size) as hex
+; print 2 byte stop address (start address + expanded size) as hex
+    lda buff_fe_size    ; keep stored size
+    pha
+    lda buff_fe_size+1
+    pha
+    jsr use_expanded_size
     jsr calc_prg_stop
+    pla
+    sta buff_fe_size+1
+    pla
+    sta buff_fe_size
     lda prg_stop+1      ; stop high
     jsr PRBYTE          
     lda prg_stop        ; stop low
     jsr PRBYTE
     lda #' '
     jsr ECHO
-; print 2 byte size (offs=4)  as decimal
+; print 2 byte stored size (offs=4)  as decimal
     lda buff_fe_size    ; size low
     sta uint2str_number
     lda buff_fe_size+1  ; size high
@@ -74,18 +169,18 @@ list_print_fileentry:
     jsr list_print_uint2str_buffer
     lda #' '
     jsr ECHO
-; print 1 byte block number (offs=0) as decimal
+; print 2 byte block number (offs=0) as decimal
     lda buffer          ; block low
     sta uint2str_number
     lda buffer+1        ; block high
     sta uint2str_number+1
     jsr uint2str
-    ldx #2              ; skip first two spaces
+    ldx #1              ; up to 4 digits, skip first space
     jsr list_print_uint2str_buffer
     lda #' '
     jsr ECHO
 ; print name (offs=6)  as char string     
-    SET_PTR buffer+6
+    SET_PTR buff_fe_name
     jsr print_msg
 list_print_fileentry_done:
     lda #CR
@@ -101,3 +196,95 @@ list_print_uint2str_buffer:
     cpx #5
     bne list_print_uint2str_buffer
     rts
+
+; ------------------------------------------------------------------------
+; ptr = address of directory cache entry A
+dir_entry:
+    pha
+    lsr                     ; index * 32, high byte
+    lsr
+    lsr
+    clc
+    adc #>dir_cache
+    sta ptr+1
+    pla
+    asl                     ; low byte
+    asl
+    asl
+    asl
+    asl
+    clc
+    adc #<dir_cache
+    sta ptr
+    bcc dir_entry_done
+    inc ptr+1
+dir_entry_done:
+    rts
+
+; ------------------------------------------------------------------------
+; keep the record of buffer in the directory cache, records past DIR_ENTRIES are not kept
+dir_store:
+    lda dir_count
+    cmp #DIR_ENTRIES
+    bcs dir_store_done
+    jsr dir_entry
+    ldy #DIR_ENTRY_SIZE-1
+dir_store_byte:
+    lda buffer, y
+    sta (ptr), y
+    dey
+    bpl dir_store_byte
+    inc dir_count
+dir_store_done:
+    rts
+
+; ------------------------------------------------------------------------
+; '@index' on the command line is a file of the last listing, its block is put into dir_block
+; and sent as '#block' does, the device does not scan the directory. If C=1, there is no such entry
+dir_resolve:
+    lda buffer+2
+    cmp #'@'
+    clc
+    bne dir_resolve_done    ; name or block
+    ldx #3
+    jsr parse_dec           ; index into ptr
+    lda ptr+1
+    bne dir_resolve_err
+    lda ptr
+    cmp dir_count
+    bcs dir_resolve_err     ; not listed, or cache is dropped
+    jsr dir_entry
+    ldy #0
+    lda (ptr), y
+    sta dir_block
+    iny
+    lda (ptr), y
+    sta dir_block+1
+    clc
+dir_resolve_done:
+    rts
+dir_resolve_err:
+    sec
+    rts
+
+; ------------------------------------------------------------------------
+; print the last listing from the directory cache, as LS printed it
+dir_list:
+    lda #0
+    sta dir_index
+dir_list_entry:
+    lda dir_index
+    cmp dir_count
+    bcs dir_list_done
+    jsr dir_entry           ; copy the record back into buffer
+    ldy #DIR_ENTRY_SIZE-1
+dir_list_copy:
+    lda (ptr), y
+    sta buffer, y
+    dey
+    bpl dir_list_copy
+    jsr list_print_fileentry
+    inc dir_index
+    jmp dir_list_entry
+dir_list_done:
+    rts
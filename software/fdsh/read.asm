@@ -3,6 +3,9 @@
 
 ; Read file, load into memory, eventualy execute loaded program
 
+; addresses within tmp_buffer
+lz_src      = tmp_buffer        ; 2 bytes, source of back reference
+
 ; load Integer-BASIC stored in ProDOS format
 load:
     lda #'b'                    ; Integer-BASIC in ProDOS format
@@ -16,13 +19,21 @@ read_request:
     lda #CMD_READ
     jsr send_request
     bcc read_request_ok         ; ok, continue
-    cmp #ST_DONE
-    beq read_done
+read_request_fail:              ; C=1, status in A
     cmp #ST_ERROR
-    beq read_err
+    bne read_request_none
+    jmp read_err
 read_request_ok:
     cmp #BODT
-    bne read_done               ; nope, no data
+    beq read_fileentry          ; data follows
+read_request_none:
+    jmp read_done               ; nope, no data
+
+load_err:
+    SET_PTR load_msg1
+    jsr print_msg
+    sec                         ; failure
+    rts
 
 ; ------------------------------------------------------------------------
 ; receive 32 bytes- store in the buffer
@@ -30,12 +41,7 @@ read_fileentry:
     ldx #0
 read_fileentry_byte:
     jsr receive_data_byte
-    bcc read_fileentry_store    ; ok, continue
-    cmp #ST_DONE
-    beq read_done
-    cmp #ST_ERROR
-    beq read_err
-read_fileentry_store:
+    bcs read_request_fail       ; no entry, or error
     sta buffer, x
     inx
     cpx #32
@@ -43,11 +49,27 @@ read_fileentry_store:
     
     lda flag
     beq read_receive_data_bytes ; process as regular file
+    lda buff_fe_flags
+    and #FE_LZ
+    cmp #FE_LZ
+    beq load_lz                 ; header is checked once it is expanded
     jsr load_basic_header
     bcs load_err                ; haven't succeeded
+    bcc read_receive_data_bytes ; always
+load_lz:
+    lda buff_fe_start+1
+    cmp #$04
+    bcc load_err                ; header would be expanded over ZP and stack
+    lda #'z'
+    sta flag
+    lda buff_fe_xsize+1         ; header is not a part of the program
+    sec
+    sbc #$02
+    sta buff_fe_xsize+1
         
 ; print message, load rest of data into memory
 read_receive_data_bytes:
+    jsr use_expanded_size
     jsr calc_prg_stop
     jsr read_print_messages_start_stop
 
@@ -59,11 +81,23 @@ read_receive_data_bytes:
     sta prg_start+1
     sta ptr+1
 
+    lda buff_fe_flags
+    and #FE_LZ
+    cmp #FE_LZ
+    bne read_receive_data_byte
+    lda flag
+    cmp #'z'
+    bne read_expand_start
+    dec ptr+1                   ; BASIC header is expanded $200 below the program
+    dec ptr+1
+read_expand_start:
+    jmp read_expand             ; compressed file
+
 read_receive_data_byte:
     jsr receive_data_byte
     bcc read_prg_store          ; ok, continue
     cmp #ST_DONE
-    beq read_prg_done
+    beq read_prg_status         ; EODT is already received
     cmp #ST_ERROR
     beq read_err
 read_prg_store:
@@ -83,11 +117,29 @@ read_skip_high:
     lda ptr+1
     cmp prg_stop+1              ; compare high byte first
     bcc read_receive_data_byte  ; if ptr+1 < prg_stop+1, continue
-    bne read_prg_done           ; if ptr+1 > prg_stop+1, exit
+    bne read_prg_eodt           ; if ptr+1 > prg_stop+1, exit
     lda ptr
     cmp prg_stop
     bcc read_receive_data_byte  ; if ptr < prg_stop, continue
 
+; EODT follows the last data byte, then MCU sends CRC check result
+read_prg_eodt:
+    jsr receive_data_byte
+    bcc read_err                ; more data than expected
+    cmp #ST_DONE
+    bne read_err
+read_prg_status:
+    jsr receive_byte            ; ACK - CRC matches or not recorded, NACK - mismatch
+    bcs read_err                ; timeout
+    cmp #ACK
+    bne read_crc_err
+    lda flag
+    cmp #'z'
+    bne read_prg_done
+    jsr load_basic_expanded
+    bcc read_prg_done
+    jmp load_err
+
 read_prg_done:
     SET_PTR read_msg3
     jsr print_msg
@@ -103,18 +155,146 @@ read_err:
     sec                         ; failure
     rts
 
-load_err:
-    SET_PTR load_msg1
+read_crc_err:
+    SET_PTR read_msg4
     jsr print_msg
     sec                         ; failure
     rts
 
+; ------------------------------------------------------------------------
+; expand LZ/RLE stream into memory at ptr, until prg_stop is reached
+;   0nnnnnnn            - n+1 literal bytes follow
+;   1nnnnnnn lo hi      - copy n+4 bytes from ptr - hi:lo, distance 1 repeats a byte
+read_expand:
+    jsr receive_data_byte       ; token
+    bcs read_expand_end
+    tax
+    bmi read_expand_match
+    inx                         ; n+1 literals
+read_expand_literal:
+    jsr receive_data_byte
+    bcs read_expand_end
+    ldy #$00
+    sta (ptr),y
+    inc ptr
+    bne read_expand_literal_next
+    inc ptr+1
+read_expand_literal_next:
+    dex
+    bne read_expand_literal
+    beq read_expand_check
+
+read_expand_match:
+    jsr receive_data_byte       ; distance low
+    bcs read_expand_end
+    sta lz_src
+    jsr receive_data_byte       ; distance high
+    bcs read_expand_end
+    sta lz_src+1
+    sec                         ; lz_src = ptr - distance
+    lda ptr
+    sbc lz_src
+    sta lz_src
+    lda ptr+1
+    sbc lz_src+1
+    sta lz_src+1
+    txa
+    and #$7f
+    clc
+    adc #4
+    tax                         ; n+4 bytes to copy
+    ldy #$00
+read_expand_copy:               ; copy forward, overlapping source repeats bytes
+    lda (lz_src),y
+    sta (ptr),y
+    iny
+    dex
+    bne read_expand_copy
+    tya                         ; ptr += length
+    clc
+    adc ptr
+    sta ptr
+    bcc read_expand_check
+    inc ptr+1
+
+read_expand_check:
+    lda ptr+1
+    cmp prg_stop+1
+    bcc read_expand             ; if ptr+1 < prg_stop+1, continue
+    bne read_expand_done
+    lda ptr
+    cmp prg_stop
+    bcc read_expand             ; if ptr < prg_stop, continue
+read_expand_done:
+    jmp read_prg_eodt
+read_expand_end:
+    cmp #ST_DONE
+    bne read_expand_err
+    jmp read_prg_status         ; EODT is already received
+read_expand_err:
+    jmp read_err
+
+; ------------------------------------------------------------------------
+; read a byte range of the file into memory, command line 'RRname#offs#len#addr'
+; device gets name, offs and len and streams just that range
+read_range:
+    jsr parse_range_args
+    bcs read_range_err          ; invalid command line
+    lda #CMD_READ_RANGE
+; A contains the command, CMD_READ_NEXT streams the same way
+read_range_request:
+    jsr send_request
+    bcc read_range_ok           ; ok, continue
+    cmp #ST_DONE
+    beq read_range_done
+read_range_err:
+    jmp read_err
+read_range_ok:
+    cmp #BODT
+    bne read_range_done         ; nope, no data
+    lda prg_start
+    sta ptr
+    lda prg_start+1
+    sta ptr+1
+
+read_range_byte:                ; data up to EODT
+    jsr receive_data_byte
+    bcs read_range_end
+    ldy #$00
+    sta (ptr),y
+    inc ptr
+    bne read_range_byte
+    inc ptr+1
+    jmp read_range_byte
+read_range_end:
+    cmp #ST_DONE
+    bne read_range_err
+    lda ptr                     ; stop follows the last byte
+    sta prg_stop
+    lda ptr+1
+    sta prg_stop+1
+    SET_PTR read_msg2
+    jsr print_msg
+    lda prg_start+1
+    jsr PRBYTE
+    lda prg_start
+    jsr PRBYTE
+    lda #'-'
+    jsr ECHO
+    lda prg_stop+1
+    jsr PRBYTE
+    lda prg_stop
+    jsr PRBYTE
+    jmp read_prg_status         ; EODT is already received
+read_range_done:
+    jmp read_done
+
 ; print messages start, stop values
 read_print_messages_start_stop:
     SET_PTR read_msg1
     jsr print_msg
 
-    SET_PTR buffer+6
+    SET_PTR buff_fe_name
     jsr print_msg
 
     SET_PTR read_msg2
@@ -193,7 +373,33 @@ load_basic_err:
     sec                         ; failure
     rts
 
+; check the header of compressed BASIC, expanded $200 below prg_start, and take $4a - $ff of it
+load_basic_expanded:
+    lda prg_start
+    sta ptr
+    lda prg_start+1
+    sec
+    sbc #$02
+    sta ptr+1
+    ldy #0
+    lda (ptr),y
+    cmp #'A'
+    bne load_basic_err          ; file signature is expected
+    iny
+    lda (ptr),y
+    cmp #'1'
+    bne load_basic_err          ; file signature is expected
+    ldy #$4a
+load_basic_expanded_zp:
+    lda (ptr),y
+    sta $0000,y
+    iny
+    bne load_basic_expanded_zp
+    clc                         ; success
+    rts
+
 read_msg1:  .text "Reading ", 0
 read_msg2:  .text " into memory ", 0
 read_msg3:  .text " .. done.", 0
+read_msg4:  .text " .. CRC error!", 13, 0
 load_msg1:  .text "This is not BASIC program", 13, 0
@@ -0,0 +1,86 @@
+; Flash Disk Shell
+; Copyright (c) 2025 Arvid Juskaitis
+
+; Print firmware counters, command line 'ST', one field per line
+stats:
+    lda #CMD_STATS
+    jsr send_request
+    bcs stats_err
+    cmp #BODT
+    bne stats_err
+    ldx #0
+stats_field:
+    lda stats_fields, x
+    beq stats_eodt
+    jsr ECHO                ; label
+    lda #'='
+    jsr ECHO
+    inx
+    inx
+    stx buffer+5            ; next field
+    lda stats_fields-1, x   ; size
+    sta buffer+4
+    bmi stats_item
+    ldx #0
+stats_value:                ; little endian into buffer
+    jsr receive_data_byte
+    bcs stats_err
+    sta buffer, x
+    inx
+    cpx buffer+4
+    bne stats_value
+stats_print:                ; most significant byte first
+    dex
+    lda buffer, x
+    jsr PRBYTE
+    cpx #0
+    bne stats_print
+    beq stats_next          ; always
+stats_item:                 ; histogram buckets, flash durations. Bit 6 of size - 2 byte items, bits 0-5 - count
+    bit buffer+4
+    bvc stats_item_byte
+    jsr receive_data_byte   ; low byte
+    bcs stats_err
+    sta buffer
+    jsr receive_data_byte
+    bcs stats_err
+    jsr PRBYTE
+    lda buffer
+    jmp stats_item_print
+stats_item_byte:
+    jsr receive_data_byte
+    bcs stats_err
+stats_item_print:
+    jsr PRBYTE
+    dec buffer+4
+    lda buffer+4
+    and #$3f
+    beq stats_next
+    lda #','
+    jsr ECHO
+    jmp stats_item
+stats_next:
+    lda #CR
+    jsr ECHO
+    ldx buffer+5
+    jmp stats_field
+stats_eodt:
+    jmp read_prg_eodt       ; EODT and status follow
+stats_err:
+    jmp read_err
+
+; label, size of the field in bytes. Bit 7 is set for a list, bit 6 for a list of 2 byte items
+stats_fields:
+    .byte 'I', 4            ; cycles in ISR
+    .byte 'M', 2            ; longest ISR
+    .byte 'B', 4            ; cycles waiting for flash
+    .byte 'S', 4            ; SPI bytes
+    .byte 'C', 2            ; SPI bytes of the last command
+    .byte 'L', $86          ; latency histograms: <1ms, <8ms, <64ms, <512ms, <4s, longer
+    .byte 'R', $86
+    .byte 'W', $86
+    .byte 'D', $86
+    .byte 'F', $C5          ; longest flash operations, 32us ticks: page, bytes, 4K, 32K, chip
+    .byte 'E', 4            ; directory entries scanned
+    .byte 'A', $C5          ; expected flash operations, 32us ticks
+    .byte 0
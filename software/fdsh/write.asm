@@ -3,6 +3,13 @@
 
 ; Save memory, write to file
 
+; addresses within tmp_buffer, used by write_block
+blk_count   = tmp_buffer        ; bytes left in the page, 0 - 256
+blk_sum     = tmp_buffer+1      ; sum of the page bytes
+blk_seg     = tmp_buffer+2      ; 1 - BASIC header $0000-$01FF is sent before the program
+blk_stop    = tmp_buffer+3      ; 2 bytes, end of the current segment
+blk_retry   = tmp_buffer+5      ; sends of the page left
+blk_page    = tmp_buffer+6      ; 4 bytes, ptr, blk_seg and blk_count at the page start
 
 ; save Integer-BASIC in ProDOS format
 save:
@@ -57,8 +64,8 @@ save_eos_found:
     lda #0
     sta buffer, x
 
-    ; send cmd_write request
-    lda #CMD_WRITE
+    ; send cmd_write_block request
+    lda #CMD_WRITE_BLOCK
     jsr send_request
     bcc store_header        ; ok, continue
     cmp #ST_DONE
@@ -74,51 +81,11 @@ store_header:
     lda #'1'
     sta $01
 
-    ; begin data transfer
-    lda #BODT
-    jsr send_byte
-    bcs store_err           ; timeout
-    jsr receive_byte        ; ACK is expected
-    bcs store_err           ; timeout
-    cmp #NACK
-    beq store_done
-
-    ; init ptr
-    lda #0
-    sta ptr
-    sta ptr+1
-
-store_header_loop:
-    ; check if ptr reached prg_stop
-    lda ptr+1
-    cmp #$02
-    bne store_header_store
-    lda ptr
-    cmp #$00
-    beq store_header_done
-
-store_header_store:
-    ldy #$00
-    lda (ptr),y
-.if DEBUG == 1
-    pha
-    jsr PRBYTE
-    lda #' '
-    jsr ECHO
-    pla
-.endif     
-    jsr send_data_byte
-    bcs store_err           ; timeout
-
-    ; increment ptr
-    inc ptr
-    bne store_header_loop
-    inc ptr+1
-    jmp store_header_loop
-
-store_header_done:
     jsr write_print_messages
-    jmp write_prg_loop_init
+    lda #1                  ; header, then the program
+    sta blk_seg
+    jmp write_block_start
+
 store_done:
     jmp write_done
 store_err:
@@ -131,13 +98,17 @@ write:
     jsr write_print_messages
 
 ; send command
-    lda #CMD_WRITE
+    lda #CMD_WRITE_BLOCK
     jsr send_request
-    bcc write_data_start    ; ok, continue
+    bcc write_block_prg     ; ok, continue
     cmp #ST_DONE
     beq write_done
     cmp #ST_ERROR
     beq write_err
+write_block_prg:
+    lda #0                  ; program only
+    sta blk_seg
+    jmp write_block_start
 
 ; start sending data
 write_data_start:
@@ -189,8 +160,10 @@ write_prg_stop:
     lda #EODT
     jsr send_byte
     bcs write_err           ; timeout
-    jsr receive_byte        ; ACK is expected
+    jsr receive_status      ; ACK is expected
     bcs write_err           ; timeout
+    cmp #NACK
+    beq write_err
 
     SET_PTR write_msg3
     jsr print_msg
@@ -204,6 +177,157 @@ write_err:
     jsr ECHO
     rts
 
+; update a byte range of the file from memory, command line 'UPname#offs#len#addr'
+; device gets name, offs and len, the file keeps its size
+update:
+    jsr parse_range_args
+    bcs write_err           ; invalid command line
+    jsr write_print_messages
+
+    lda #CMD_UPDATE
+    jsr send_request
+    bcc update_data_start   ; ok, continue
+    cmp #ST_DONE
+    beq write_done
+    bne write_err
+update_data_start:
+    jmp write_data_start
+
+write_block_done:
+    jmp write_done
+write_block_err:
+    jmp write_err
+
+; stream memory to CMD_WRITE_BLOCK. Pages are sent without handshakes, the first one is shorter by
+; FileEntry_t. Sum of the bytes follows every page, MCU replies once it is programmed, NACK if the sum
+; does not match, then the page is sent again
+write_block_start:
+    lda #BODT
+    jsr send_byte
+    bcs write_block_err     ; timeout
+    jsr receive_byte        ; ACK is expected
+    bcs write_block_err     ; timeout
+    cmp #NACK
+    beq write_block_done
+
+    lda #0                  ; header segment, or the program
+    sta ptr
+    sta ptr+1
+    lda blk_seg
+    bne write_block_first
+    lda prg_start
+    sta ptr
+    lda prg_start+1
+    sta ptr+1
+write_block_first:
+    jsr write_block_seg_stop
+    lda #256-32             ; FileEntry_t leads the first page
+    sta blk_count
+
+write_block_page:
+    lda #3
+    sta blk_retry
+    lda ptr
+    sta blk_page
+    lda ptr+1
+    sta blk_page+1
+    lda blk_seg
+    sta blk_page+2
+    lda blk_count
+    sta blk_page+3
+write_block_resend:
+    lda #0
+    sta blk_sum
+write_block_loop:
+    jsr write_block_next
+    bcs write_block_sum     ; no data left
+    tax
+    clc
+    adc blk_sum
+    sta blk_sum
+    txa
+    jsr send_block_byte
+    bcs write_block_err     ; timeout
+    dec blk_count
+    bne write_block_loop
+write_block_sum:
+    lda blk_sum
+    jsr send_block_sum
+    bcs write_block_err     ; timeout
+    cmp #ACK
+    beq write_block_acked
+    dec blk_retry           ; NACK, send the page again
+    beq write_block_err
+    lda blk_page
+    sta ptr
+    lda blk_page+1
+    sta ptr+1
+    lda blk_page+2
+    sta blk_seg
+    lda blk_page+3
+    sta blk_count
+    jsr write_block_seg_stop
+    jmp write_block_resend
+write_block_acked:
+    jsr write_block_at_end
+    bcc write_block_page    ; more pages follow
+
+    SET_PTR write_msg3
+    jsr print_msg
+    jmp write_done
+
+; next byte in A, C=1 if all data is sent
+write_block_next:
+    jsr write_block_at_end
+    bcs write_block_next_done
+    ldy #0
+    lda (ptr), y
+    inc ptr
+    bne write_block_next_ok
+    inc ptr+1
+write_block_next_ok:
+    clc
+write_block_next_done:
+    rts
+
+; C=1 if all data is sent, moves to the program once the header segment is sent
+write_block_at_end:
+    lda ptr
+    cmp blk_stop
+    bne write_block_not_end
+    lda ptr+1
+    cmp blk_stop+1
+    bne write_block_not_end
+    lda blk_seg
+    beq write_block_end     ; C=1 after cmp
+    lda #0
+    sta blk_seg
+    lda prg_start
+    sta ptr
+    lda prg_start+1
+    sta ptr+1
+    jsr write_block_seg_stop
+    jmp write_block_at_end  ; program could be empty
+write_block_not_end:
+    clc
+write_block_end:
+    rts
+
+; blk_stop is the end of the segment in blk_seg
+write_block_seg_stop:
+    lda blk_seg
+    beq write_block_seg_prg
+    lda #$00
+    sta blk_stop
+    lda #$02
+    sta blk_stop+1
+    rts
+write_block_seg_prg:
+    lda prg_stop
+    sta blk_stop
+    lda prg_stop+1
+    sta blk_stop+1
+    rts
 
 ; Parse string in format 'wname#xxxx#xxxx' and extract xxxx values
 write_parse_cmd_args:
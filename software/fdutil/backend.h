@@ -0,0 +1,31 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "simplefs.h"
+
+// File operations of fdutil, done on an image file or by the device over serial port.
+// A file is addressed by name, or by block if the name is empty. Status is SimpleFS_Status_t
+typedef struct {
+    bool (*begin)(const char *target);
+    void (*end)();
+    // entry is called for every file matching the pattern
+    uint8_t (*list)(const char *pattern, void (*entry)(const FileEntry_t *fe));
+    // buffer of BLOCK_SIZE gets FileEntry_t and data, *psize is the size of both
+    uint8_t (*read)(const char *name, uint16_t block, uint8_t *buffer, uint16_t *psize);
+    // xsize is the expanded size of LZ compressed data, 0 if data is stored as is
+    uint8_t (*write)(const char *name, uint16_t start, uint16_t xsize, const uint8_t *data, uint16_t size, uint16_t *pblock);
+    uint8_t (*remove)(const char *name, uint16_t block);
+    uint8_t (*stat)(const char *name, uint16_t block, FileEntry_t *fe);
+} Backend_t;
+
+extern const Backend_t image_backend;
+extern const Backend_t serial_backend;
+
+// Target is a serial port (or PTY of fdserver) if it starts with /dev/, otherwise an image file
+const Backend_t *Backend_open(const char *target);
@@ -0,0 +1,23 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include "crc32.h"
+
+// Nibble-wide table, the same one firmware keeps in program memory
+static const uint32_t crc32_table[16] = {
+    0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+    0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+    0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+    0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+};
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint16_t size) {
+    while (size--) {
+        uint8_t b = *data++;
+        crc = crc32_table[(crc ^ b) & 0x0f] ^ (crc >> 4);
+        crc = crc32_table[(crc ^ (b >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return crc;
+}
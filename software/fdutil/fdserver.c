@@ -0,0 +1,62 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+// Firmware file server compiled natively over the image file, it listens on a PTY,
+// so fdutil and other clients could be tested without the device
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "simplefs.h"
+#include "w25q64fv.h"
+#include "fileserver.h"
+#include "uart.h"
+
+extern int uart_fd;
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s <image_file>\n", argv[0]);
+        printf("Serves the image as the device does over UART, prints the PTY to use as <image_file> of fdutil\n");
+        return 1;
+    }
+    if (W25Q64FV_begin(argv[1]) != W25Q64FV_OK) {
+        fprintf(stderr, "Error: Failed to open file system image.\n");
+        return 1;
+    }
+
+    uart_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (uart_fd < 0 || grantpt(uart_fd) || unlockpt(uart_fd)) {
+        perror("Error opening PTY");
+        return 1;
+    }
+    // Slave side is kept open, so reads do not fail while no client is connected
+    const char *name = ptsname(uart_fd);
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio)) {
+        perror("Error opening PTY");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    printf("%s\n", name);
+    fflush(stdout);
+
+    uint8_t buff[PAGE_SIZE];
+#if SNAPSHOT
+    SimpleFS_mount(buff);
+#endif
+    // Single character commands as in the firmware main loop, only file requests are served
+    while (1) {
+        if (uart_receive_blocking() == 'F') {
+            FileServer_request(buff);
+        }
+    }
+}
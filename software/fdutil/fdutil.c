@@ -6,19 +6,49 @@ Copyright (c) 2025 Arvid Juskaitis
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include "simplefs.h"
 #include "w25q64fv.h"
+#include "backend.h"
+#include "lz.h"
+#include "crc32.h"
+#include "iostat.h"
+
+#define MAX_EXPANDED_SIZE 0xffff    // compressed file expands into 6502 memory
 
 // Function Prototypes
 void usage(const char *progname);
-int handle_init(const char *imagefile, short numberOfBlocks);
+int handle_init(const char *imagefile, short numberOfBlocks, const char *model);
 int handle_move(const char *imagefile, short firstBlock);
+int handle_upgrade(const char *imagefile);
 int handle_list(const char *imagefile, const char *prefix);
-int handle_write(const char *imagefile, const char *input, const char *filename);
+int handle_write(const char *imagefile, const char *input, const char *filename, bool compress);
 int handle_read(const char *imagefile, const char *input, const char *filename);
+int handle_read_range(const char *imagefile, const char *input, const char *filename);
+int handle_update(const char *imagefile, const char *input, const char *filename);
 int handle_delete(const char *imagefile, const char *command);
+int handle_stat(const char *imagefile, const char *input);
+int parse_file_args(const char *input, char *name, uint16_t *pblock, uint16_t *args, int nargs);
+void print_iostat(void);
+void print_model(void);
 
 int main(int argc, char **argv) {
+    // --stats and --nor may be given anywhere, they are taken out before the command is parsed
+    bool nor = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            atexit(print_iostat);
+        } else if (strcmp(argv[i], "--nor") == 0) {
+            nor = true;
+        } else {
+            continue;
+        }
+        memmove(argv + i, argv + i + 1, (argc - i) * sizeof(char *));
+        argc--;
+        i--;
+    }
+
     if (argc < 3) {
         usage(argv[0]);
         return 1;
@@ -27,13 +57,29 @@ int main(int argc, char **argv) {
     const char *filename = argv[1];
     const char *command = argv[2];
 
+    // Serial port serves only file operations, the image is changed by the device
+    if (strncmp(filename, "/dev/", 5) == 0 && !strchr("lwzrds", command[0])) {
+        fprintf(stderr, "Error: Command %c is not supported over serial port.\n", command[0]);
+        return 1;
+    }
+
+    // Init, move and upgrade rewrite the image as a file, the chip is accessed by file operations only
+    if (nor) {
+        if (!strchr("lwzrpeds", command[0])) {
+            fprintf(stderr, "Error: Command %c is not supported with --nor.\n", command[0]);
+            return 1;
+        }
+        W25Q64FV_model(true);
+        atexit(print_model);
+    }
+
     if (strcmp(command, "i") == 0) {
-        if (argc != 4) {
+        if (argc != 4 && argc != 5) {
             usage(argv[0]);
             return 1;
         }
         short numberOfBlocks = (short) atoi(argv[3]);
-        return handle_init(filename, numberOfBlocks);
+        return handle_init(filename, numberOfBlocks, argc == 5 ? argv[4] : "w25q64");
     } else if (strcmp(command, "m") == 0) {
         if (argc != 4) {
             usage(argv[0]);
@@ -41,23 +87,39 @@ int main(int argc, char **argv) {
         }
         short firstBlock = (short) atoi(argv[3]);
         return handle_move(filename, firstBlock);
+    } else if (strcmp(command, "u") == 0) {
+        return handle_upgrade(filename);
     } else if (strcmp(command, "l") == 0 || strncmp(command, "l", 1) == 0) {
         const char *prefix = command + 1; // Extract prefix if any
         return handle_list(filename, prefix);
-    } else if (command[0] == 'w') {
+    } else if (command[0] == 'w' || command[0] == 'z') {
         if (argc != 4) {
             usage(argv[0]);
             return 1;
         }
-        return handle_write(filename, command + 1, argv[3]);
+        return handle_write(filename, command + 1, argv[3], command[0] == 'z');
     } else if (command[0] == 'r') {
         if (argc != 4) {
             usage(argv[0]);
             return 1;
         }
         return handle_read(filename, command + 1, argv[3]);
+    } else if (command[0] == 'p') {
+        if (argc != 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return handle_read_range(filename, command + 1, argv[3]);
+    } else if (command[0] == 'e') {
+        if (argc != 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return handle_update(filename, command + 1, argv[3]);
     } else if (command[0] == 'd') {
         return handle_delete(filename, command + 1);
+    } else if (command[0] == 's') {
+        return handle_stat(filename, command + 1);
     }
 
     usage(argv[0]);
@@ -65,17 +127,71 @@ int main(int argc, char **argv) {
 }
 
 void usage(const char *progname) {
-    printf("Usage: %s <image_file> <command> [args]\n", progname);
+    printf("Usage: %s <image_file|serial_port> <command> [args]\n", progname);
     printf("Commands:\n");
-    printf("  i <num_blocks>                Initialize image for <num_blocks> blocks\n");
-    printf("  m <first_block>               Move/reindex image starting with <first_block>\n");
-    printf("  l[prefix]                     List files, optionally filtered by prefix\n");
+    printf("  i <num_blocks> [model]        Initialize image for <num_blocks> 32 Kb blocks\n");
+    printf("                                model - w25q64 (default), w25q128 or w25q256\n");
+    printf("  m <first_block>               Move/reindex image starting with 32 Kb <first_block>\n");
+    printf("  u                             Upgrade image written by older releases to current entry format\n");
+    printf("  l[prefix]                     List files, optionally filtered by prefix, may contain * and ?\n");
     printf("  w<name>#<start>#<stop> <file> Write file to disk image. start, stop - hex\n");
+    printf("  z<name>#<start>#<stop> <file> Write file compressed, fdsh expands it while loading\n");
     printf("  r<name|#block> <file>         Read file by name or block ID\n");
+    printf("  p<name|#block>#<offs>#<len> <file> Read part of the file, offs, len - hex\n");
+    printf("  e<name>#<offs> <file>         Update file in place from offs (hex), size stays the same\n");
     printf("  d<name|#block>                Delete file by name or block ID\n");
+    printf("  s<name|#block>                Show file entry by name or block ID\n");
+    printf("serial_port - /dev/... of the device or PTY of fdserver, l, w, z, r, d and s are supported\n");
+    printf("--stats - print flash reads, programs, erases and busy polls per file system operation\n");
+    printf("--nor   - model NOR flash: program clears bits only, simulated busy time, sector wear\n");
 }
 
-int handle_init(const char *imagefile, short numberOfBlocks) {
+void print_model(void) {
+    W25Q64FV_model_report(stderr);
+}
+
+// Image operations only, over serial port flash is accessed by the device, see 's' of the UART console
+void print_iostat(void) {
+    static const char *names[IO_OPS] = {
+        "other", "list", "open", "read", "verify", "create", "write", "delete", "stat", "update"
+    };
+    IoStat_t total = {0};
+    fprintf(stderr, "%-8s %8s %10s %8s %10s %6s %6s\n", "op", "reads", "rbytes", "programs", "pbytes", "erases", "polls");
+    for (int op = 0; op < IO_OPS; op++) {
+        const IoStat_t *s = &iostat[op];
+        if (!s->reads && !s->programs && !s->erases && !s->polls) {
+            continue;
+        }
+        fprintf(stderr, "%-8s %8u %10u %8u %10u %6u %6u\n", names[op], s->reads, s->read_bytes,
+                s->programs, s->program_bytes, s->erases, s->polls);
+        total.reads += s->reads;
+        total.read_bytes += s->read_bytes;
+        total.programs += s->programs;
+        total.program_bytes += s->program_bytes;
+        total.erases += s->erases;
+        total.polls += s->polls;
+    }
+    fprintf(stderr, "%-8s %8u %10u %8u %10u %6u %6u\n", "total", total.reads, total.read_bytes,
+            total.programs, total.program_bytes, total.erases, total.polls);
+}
+
+int handle_init(const char *imagefile, short numberOfBlocks, const char *model) {
+    uint32_t capacity;
+    if (strcasecmp(model, "w25q64") == 0) {
+        capacity = 1UL << W25Q64FV_CAPACITY_8MB;
+    } else if (strcasecmp(model, "w25q128") == 0) {
+        capacity = 1UL << W25Q64FV_CAPACITY_16MB;
+    } else if (strcasecmp(model, "w25q256") == 0) {
+        capacity = 1UL << W25Q64FV_CAPACITY_32MB;
+    } else {
+        fprintf(stderr, "Error: Unknown chip model %s.\n", model);
+        return 1;
+    }
+    if (numberOfBlocks <= 0 || numberOfBlocks > capacity / BLOCK_SIZE) {
+        fprintf(stderr, "Error: %s holds up to %lu blocks.\n", model, (unsigned long)(capacity / BLOCK_SIZE));
+        return 1;
+    }
+
     if (W25Q64FV_init(imagefile, numberOfBlocks) != W25Q64FV_OK) {
         fprintf(stderr, "Error: Failed to initialize file system image.\n");
         return 1;
@@ -98,9 +214,16 @@ int handle_move(const char *imagefile, short firstBlock) {
     size_t blockOffset = 0;
 
     while ((bytesRead = fread(buffer, 1, BLOCK_SIZE, file)) == BLOCK_SIZE) {
-        // Update first two bytes with the new block index (little-endian)
-        buffer[0] = blockIndex & 0xFF;
-        buffer[1] = (blockIndex >> 8) & 0xFF;
+        // Update block number of every file entry in the block, files are aligned to their size class
+        for (uint16_t sector = 0; sector < SECTORS_PER_BLOCK; ) {
+            FileEntry_t *fe = (FileEntry_t *)(buffer + sector * SECTOR_SIZE);
+            if (fe->block == 0xffff) {
+                sector++;
+                continue;
+            }
+            fe->block = blockIndex * SECTORS_PER_BLOCK + sector;
+            sector = SimpleFS_nextBlock((uint8_t *)fe, sector);
+        }
 
         // Move back and write the modified block
         fseek(file, blockOffset, SEEK_SET);
@@ -124,36 +247,215 @@ int handle_move(const char *imagefile, short firstBlock) {
     return 0;
 }
 
-int handle_list(const char *imagefile, const char *prefix) {
-    uint8_t buffer[BLOCK_SIZE + PAGE_SIZE];
-    uint16_t block = 0;
+// Older entry: block, start, size, name[19], flags, xsize, crc.
+// The oldest one has name[26] and no flags, told apart by FE_FLAGS_VALID at offset 25
+#define OLD_NAME_SIZE 26
 
-    if (W25Q64FV_begin(imagefile) != W25Q64FV_OK) {
-        fprintf(stderr, "Error: Failed to open file system image.\n");
+typedef char EntryName_t[OLD_NAME_SIZE + 1];
+
+// Name of an entry upper-cased, as long as it is stored
+static void entry_name(const uint8_t *sector_data, bool current, char *name) {
+    int size = current ? MAX_NAME_SIZE : (sector_data[25] & FE_FLAGS_VALID) ? 19 : OLD_NAME_SIZE;
+    const uint8_t *stored = current ? (const uint8_t *)((const FileEntry_t *)sector_data)->name : sector_data + 6;
+    memset(name, 0, sizeof(EntryName_t));
+    for (int i = 0; i < size && stored[i]; i++) {
+        name[i] = toupper(stored[i]);
+    }
+}
+
+// Name is cut to MAX_NAME_SIZE - 1, ~N replaces its tail if the cut one is taken by another entry
+static bool shorten_name(EntryName_t *names, int count, int index) {
+    char *name = names[index];
+    char cut[MAX_NAME_SIZE];
+    for (int n = 0; n < 100; n++) {
+        char suffix[4] = "";
+        if (n) {
+            snprintf(suffix, sizeof(suffix), "~%d", n);
+        }
+        snprintf(cut, sizeof(cut), "%.*s%s", (int)(MAX_NAME_SIZE - 1 - strlen(suffix)), name, suffix);
+        bool taken = false;
+        for (int i = 0; i < count && !taken; i++) {
+            taken = i != index && strncmp(names[i], cut, MAX_NAME_SIZE - 1) == 0;
+        }
+        if (!taken) {
+            printf("Name %s is longer than %d chars, renamed to %s.\n", name, MAX_NAME_SIZE - 1, cut);
+            strcpy(name, cut);
+            return true;
+        }
+    }
+    fprintf(stderr, "Error: Name %s is longer than %d chars, no unique name is left for it.\n", name, MAX_NAME_SIZE - 1);
+    return false;
+}
+
+// Entry is already in current format if its hash and size class agree with name and size
+static bool is_current_entry(const FileEntry_t *fe, uint16_t sector) {
+    char name[MAX_NAME_SIZE + 1] = {0};
+    memcpy(name, fe->name, MAX_NAME_SIZE);
+    return (fe->flags & FE_FLAGS_VALID) && fe->block == sector
+        && fe->hash == SimpleFS_nameHash(name)
+        && (fe->flags & FE_CLASS_MASK) >> FE_CLASS_SHIFT == SimpleFS_sizeClass(fe->size);
+}
+
+// Name is the one entry_name gave, shortened if it did not fit
+static void upgrade_entry(uint8_t *sector_data, uint16_t sector, const char *name) {
+    uint8_t old[sizeof(FileEntry_t)];
+    memcpy(old, sector_data, sizeof(old));
+    FileEntry_t *fe = (FileEntry_t *)sector_data;
+    bool has_flags = old[25] & FE_FLAGS_VALID;
+    uint16_t size = old[4] | old[5] << 8;
+
+    memset(fe, 0, sizeof(FileEntry_t));
+    fe->block = sector;
+    fe->start = old[2] | old[3] << 8;
+    fe->size = size;
+    strncpy(fe->name, name, MAX_NAME_SIZE - 1);
+    fe->hash = SimpleFS_nameHash(fe->name);
+    fe->flags = FE_FLAGS_VALID | SimpleFS_sizeClass(size) << FE_CLASS_SHIFT;
+    if (has_flags && (old[25] & FE_FLAG_LZ)) {
+        fe->flags |= FE_FLAG_LZ;
+        fe->xsize = old[26] | old[27] << 8;
+    }
+    // CRC is recomputed, old images may not have it
+    fe->flags |= FE_FLAG_CRC;
+    fe->crc = crc32_final(crc32_update(CRC32_INIT, sector_data + sizeof(FileEntry_t), size));
+}
+
+// Names of all entries upper-cased, in image order, as long as they are stored
+static bool collect_names(FILE *file, EntryName_t **pnames, int *pcount) {
+    static uint8_t buffer[BLOCK_SIZE];
+    EntryName_t *names = NULL;
+    int count = 0;
+    size_t blockOffset = 0;
+
+    while (fread(buffer, 1, BLOCK_SIZE, file) == BLOCK_SIZE) {
+        for (uint16_t sector = 0; sector < SECTORS_PER_BLOCK; ) {
+            FileEntry_t *fe = (FileEntry_t *)(buffer + sector * SECTOR_SIZE);
+            uint16_t sectorNo = blockOffset / SECTOR_SIZE + sector;
+            if (fe->block == 0xffff) {
+                sector++;
+                continue;
+            }
+            EntryName_t *more = realloc(names, (count + 1) * sizeof(EntryName_t));
+            if (!more) {
+                perror("Error allocating names");
+                free(names);
+                return false;
+            }
+            names = more;
+            bool current = is_current_entry(fe, sectorNo);
+            entry_name((uint8_t *)fe, current, names[count++]);
+            // Upgraded entry gets the size class of its size, so both passes step the same way
+            uint8_t *old = (uint8_t *)fe;
+            sector += current ? FE_SECTORS(fe) : 1 << SimpleFS_sizeClass(old[4] | old[5] << 8);
+        }
+        blockOffset += BLOCK_SIZE;
+    }
+    if (ferror(file)) {
+        perror("Error reading file");
+        free(names);
+        return false;
+    }
+    *pnames = names;
+    *pcount = count;
+    return true;
+}
+
+// Names are collected first, so a name longer than MAX_NAME_SIZE - 1 gets one no other entry has.
+// Nothing is written if that fails
+int handle_upgrade(const char *imagefile) {
+    FILE *file = fopen(imagefile, "r+b");
+    if (!file) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    EntryName_t *names = NULL;
+    int count = 0;
+    bool ok = collect_names(file, &names, &count);
+    for (int i = 0; ok && i < count; i++) {
+        if (strlen(names[i]) >= MAX_NAME_SIZE) {
+            ok = shorten_name(names, count, i);
+        }
+    }
+    if (!ok) {
+        free(names);
+        fclose(file);
         return 1;
     }
 
-    uint8_t status;
-    FileEntry_t *entry = (FileEntry_t *) buffer;
-    printf("Start    Stop  Size Blck Name\n-----------------------------\n");
-     do {
-        status = SimpleFS_listFiles(buffer, &block, prefix);
-        if (status != OK) break;
-        printf("$%04X - $%04X %5d %4d %s\n", 
-            entry->start, entry->start + entry->size, entry->size, entry->block, entry->name);
-        block++;
-    } while (status == OK);
+    // Whole block at once, file data follows the entry within the block
+    static uint8_t buffer[BLOCK_SIZE];
+    size_t blockOffset = 0;
+    int entry = 0;
+    int upgraded = 0;
+
+    fseek(file, 0, SEEK_SET);
+    while (fread(buffer, 1, BLOCK_SIZE, file) == BLOCK_SIZE) {
+        for (uint16_t sector = 0; sector < SECTORS_PER_BLOCK; ) {
+            FileEntry_t *fe = (FileEntry_t *)(buffer + sector * SECTOR_SIZE);
+            uint16_t sectorNo = blockOffset / SECTOR_SIZE + sector;
+            if (fe->block == 0xffff) {
+                sector++;
+                continue;
+            }
+            if (!is_current_entry(fe, sectorNo)) {
+                upgrade_entry((uint8_t *)fe, sectorNo, names[entry]);
+                upgraded++;
+            }
+            entry++;
+            sector += FE_SECTORS(fe);
+        }
 
-    W25Q64FV_end();
+        fseek(file, blockOffset, SEEK_SET);
+        if (fwrite(buffer, 1, BLOCK_SIZE, file) != BLOCK_SIZE) {
+            perror("Error writing to file");
+            free(names);
+            fclose(file);
+            return 1;
+        }
+        blockOffset += BLOCK_SIZE;
+        fseek(file, blockOffset, SEEK_SET);
+    }
+    free(names);
+
+    if (ferror(file)) {
+        perror("Error reading file");
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+    printf("%d file entries upgraded.\n", upgraded);
+    return 0;
+}
+
+static void print_entry(const FileEntry_t *entry) {
+    uint16_t xsize = (entry->flags & (FE_FLAGS_VALID | FE_FLAG_LZ)) == (FE_FLAGS_VALID | FE_FLAG_LZ) ? entry->xsize : entry->size;
+    printf("$%04X - $%04X %5d %5d %4d %.*s\n", 
+        entry->start, entry->start + xsize, xsize, entry->size, entry->block, MAX_NAME_SIZE, entry->name);
+}
+
+int handle_list(const char *imagefile, const char *prefix) {
+    const Backend_t *backend = Backend_open(imagefile);
+    if (!backend) {
+        return 1;
+    }
+
+    printf("Start    Stop  Size Store Blck Name\n-----------------------------------\n");
+    uint8_t status = backend->list(prefix, print_entry);
+    backend->end();
+    if (status != OK) {
+        fprintf(stderr, "Error: Failed to list files.\n");
+        return 1;
+    }
     return 0;
 }
 
-int handle_write(const char *imagefile, const char *input, const char *filename) {
-    char name[MAX_NAME_SIZE], name_start_stop[MAX_NAME_SIZE + 20];
-    uint16_t start = 0, stop = 0, size = 0;
-    uint8_t buffer[BLOCK_SIZE + PAGE_SIZE];
+int handle_write(const char *imagefile, const char *input, const char *filename, bool compress) {
+    char name[MAX_NAME_SIZE];
+    uint16_t start = 0, stop = 0;
+    uint8_t data[MAX_EXPANDED_SIZE], packed[LZ_MAX_COMPRESSED_SIZE(MAX_EXPANDED_SIZE)];
 
-    if (sscanf(input, "%[^#]#%hx#%hx", name, &start, &stop) < 3) {
+    if (sscanf(input, "%17[^#]#%hx#%hx", name, &start, &stop) < 3) {
         fprintf(stderr, "Error: Invalid syntax for write.\n");
         return 1;
     }
@@ -161,85 +463,125 @@ int handle_write(const char *imagefile, const char *input, const char *filename)
     FILE *fp = fopen(filename, "rb");
     if (!fp) {
         fprintf(stderr, "Error: Failed to open input file %s.\n", filename);
-        W25Q64FV_end();
         return 1;
     }
-    // Determine the current file size
-    fseek(fp, 0, SEEK_END);
-    uint16_t actual_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    // Compressed file may expand beyond the block, up to 64 Kb of 6502 memory
+    size_t actual_size = fread(data, 1, compress ? MAX_EXPANDED_SIZE : BLOCK_SIZE, fp);
+    fclose(fp);
 
-    sprintf(name_start_stop, "%s#%x#%x", name, start, start + actual_size);
+    // Data to store on disk, compressed or as is
+    uint8_t *stored = data;
+    size_t stored_size = actual_size;
+    if (compress) {
+        stored = packed;
+        stored_size = lz_compress(data, actual_size, packed);
+        fprintf(stdout, "Compressed %zu bytes to %zu bytes\n", actual_size, stored_size);
+    }
+    if (stored_size > BLOCK_SIZE - sizeof(FileEntry_t)) {
+        fprintf(stderr, "Error: File %s does not fit into the block.\n", filename);
+        return 1;
+    }
 
-    if (W25Q64FV_begin(imagefile) != W25Q64FV_OK) {
-        fprintf(stderr, "Error: Failed to open file system image.\n");
+    const Backend_t *backend = Backend_open(imagefile);
+    if (!backend) {
         return 1;
     }
 
-    uint16_t block = 0;
-    size = actual_size;
-    memset(buffer, 0xFF, BLOCK_SIZE);
-    if (SimpleFS_createFileEntry(buffer, name_start_stop, &block, &size) != OK) {
-        fprintf(stderr, "Error: Failed to create file entry for %s.\n", name);
-        W25Q64FV_end();
+    uint16_t block;
+    fprintf(stdout, "Number of bytes to write: %zu\n", stored_size);
+    if (backend->write(name, start, compress ? actual_size : 0, stored, stored_size, &block) != OK) {
+        fprintf(stderr, "Error: Failed to write file for %s.\n", name);
+        backend->end();
+        return 1;
+    }
+
+    printf("File %s size_written successfully.\n", name);
+    backend->end();
+    return 0;
+}
+
+int handle_read(const char *imagefile, const char *input, const char *filename) {
+    uint8_t buffer[BLOCK_SIZE];
+    char name[MAX_NAME_SIZE];
+    uint16_t block, size;
+
+    if (!parse_file_args(input, name, &block, NULL, 0)) {
+        fprintf(stderr, "Error: Invalid syntax for read.\n");
+        return 1;
+    }
+
+    const Backend_t *backend = Backend_open(imagefile);
+    if (!backend) {
         return 1;
     }
-    fprintf(stdout, "Number of bytes to write: %d\n", actual_size);
-    fread(buffer + sizeof(FileEntry_t), 1, BLOCK_SIZE - sizeof(FileEntry_t), fp);
 
-    uint8_t *ptr = buffer;
-    int16_t size_written = 0;
-    while (size_written < size) {
-        uint8_t status = SimpleFS_writeFile(ptr);
-        if (status != OK) {
-            fprintf(stderr, "Error: Failed to write file for %s.\n", name);
+    uint8_t status = backend->read(name, block, buffer, &size);
+    if (status == CRC_MISMATCH) {
+        fprintf(stderr, "Error: CRC mismatch in file %s.\n", input);
+        backend->end();
+        return 1;
+    } else if (status != OK) {
+        fprintf(stderr, "Error: Failed to read file %s.\n", input);
+        backend->end();
+        return 1;
+    }
+    backend->end();
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: Failed to open output file %s.\n", filename);
+        return 1;
+    }
+
+    FileEntry_t *fe = (FileEntry_t *)buffer;
+    if ((fe->flags & (FE_FLAGS_VALID | FE_FLAG_LZ)) == (FE_FLAGS_VALID | FE_FLAG_LZ)) {
+        uint8_t expanded[MAX_EXPANDED_SIZE];
+        size_t expanded_size = lz_expand(buffer + sizeof(FileEntry_t), size - sizeof(FileEntry_t), expanded, sizeof(expanded));
+        if (expanded_size != fe->xsize) {
+            fprintf(stderr, "Error: Failed to expand file %s.\n", input);
             fclose(fp);
             return 1;
         }
-        size_written += PAGE_SIZE;
-        ptr += PAGE_SIZE;
+        fwrite(expanded, 1, expanded_size, fp);
+    } else {
+        fwrite(buffer + sizeof(FileEntry_t), 1, size - sizeof(FileEntry_t), fp);
     }
     fclose(fp);
 
-    printf("File %s size_written successfully.\n", name);
-    W25Q64FV_end();
+    printf("File %s read successfully to %s.\n", input, filename);
     return 0;
 }
 
-int handle_read(const char *imagefile, const char *input, const char *filename) {
+int handle_read_range(const char *imagefile, const char *input, const char *filename) {
     uint8_t buffer[BLOCK_SIZE];
-    uint16_t size;
-    uint8_t status;
+    char name[MAX_NAME_SIZE];
+    uint16_t block, args[2], size;    // offset, length
 
-    if (W25Q64FV_begin(imagefile) != W25Q64FV_OK) {
-        fprintf(stderr, "Error: Failed to open file system image.\n");
+    if (!parse_file_args(input, name, &block, args, 2)) {
+        fprintf(stderr, "Error: Invalid syntax for read range.\n");
         return 1;
     }
 
-    if (input[0] == '#') {
-        uint16_t block = atoi(input + 1);
-        status = SimpleFS_readFileByBlockNo(buffer, block, &size);
-    } else {
-        status = SimpleFS_readFileByName(buffer, input, &size);
-    }
-    if (status != OK) {
-        fprintf(stderr, "Error: Failed to read file %s.\n", input);
-        W25Q64FV_end();
+    if (W25Q64FV_begin(imagefile) != W25Q64FV_OK) {
+        fprintf(stderr, "Error: Failed to open file system image.\n");
         return 1;
     }
 
+    IoStat_begin(IO_OPEN);
+    uint8_t status = SimpleFS_readFileRange(buffer, name, block, args[0], args[1], &size);
     uint8_t *ptr = buffer + PAGE_SIZE;  // we have alread read 1st buffer
     uint16_t current_size = PAGE_SIZE;
-    while (current_size < size) {
+    IoStat_begin(IO_READ);
+    while (status == OK && current_size < size) {
         status = SimpleFS_readFileNextPage(ptr);
-        if (status != OK) {
-            fprintf(stderr, "Error: Failed to read file %s.\n", input);
-            W25Q64FV_end();
-            return 1;
-        }
         ptr += PAGE_SIZE;
         current_size += PAGE_SIZE;
     }
+    if (status != OK) {
+        fprintf(stderr, "Error: Failed to read file %s.\n", input);
+        W25Q64FV_end();
+        return 1;
+    }
 
     FILE *fp = fopen(filename, "wb");
     if (!fp) {
@@ -247,38 +589,154 @@ int handle_read(const char *imagefile, const char *input, const char *filename)
         W25Q64FV_end();
         return 1;
     }
-
-    fwrite(buffer + sizeof(FileEntry_t), 1, size - sizeof(FileEntry_t), fp);
+    fwrite(buffer, 1, size, fp);
     fclose(fp);
 
-    printf("File %s read successfully to %s.\n", input, filename);
+    printf("%u bytes of %s read successfully to %s.\n", size, input, filename);
     W25Q64FV_end();
     return 0;
 }
 
-int handle_delete(const char *imagefile, const char *command) {
-    uint8_t buffer[PAGE_SIZE];
-    uint16_t block = (command[0] == '#') ? atoi(command + 1) : 0;
-    uint8_t status;
+int handle_update(const char *imagefile, const char *input, const char *filename) {
+    uint8_t buffer[PAGE_SIZE], data[BLOCK_SIZE];
+    char name[MAX_NAME_SIZE];
+    uint16_t block, offset, size, idx;
+
+    if (!parse_file_args(input, name, &block, &offset, 1)) {
+        fprintf(stderr, "Error: Invalid syntax for update.\n");
+        return 1;
+    }
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Failed to open input file %s.\n", filename);
+        return 1;
+    }
+    size_t actual_size = fread(data, 1, BLOCK_SIZE, fp);
+    fclose(fp);
 
     if (W25Q64FV_begin(imagefile) != W25Q64FV_OK) {
         fprintf(stderr, "Error: Failed to open file system image.\n");
         return 1;
     }
 
-    if (command[0] == '#') {
-        status = SimpleFS_deleteFileByBlockNo(buffer, block);
-    } else {
-        status = SimpleFS_deleteFileByName(buffer, command);
+    IoStat_begin(IO_UPDATE);
+    uint8_t status = SimpleFS_updateBegin(buffer, name, block, offset, actual_size, &size, &idx);
+    uint8_t *ptr = data;
+    while (status == OK && size) {
+        uint16_t n = PAGE_SIZE - idx < size ? PAGE_SIZE - idx : size;
+        memcpy(buffer + idx, ptr, n);
+        status = SimpleFS_updateWrite(buffer, n);
+        ptr += n;
+        size -= n;
+        idx = 0;
+    }
+    if (status == OK) {
+        status = SimpleFS_updateFinish();
     }
-
     if (status != OK) {
-        fprintf(stderr, "Error: Failed to delete file %s.\n", command);
+        fprintf(stderr, "Error: Failed to update file %s.\n", input);
         W25Q64FV_end();
         return 1;
     }
 
-    printf("File %s deleted successfully.\n", command);
+    printf("File %s updated successfully.\n", input);
     W25Q64FV_end();
     return 0;
 }
+
+int handle_delete(const char *imagefile, const char *command) {
+    char name[MAX_NAME_SIZE];
+    uint16_t block;
+
+    if (!parse_file_args(command, name, &block, NULL, 0)) {
+        fprintf(stderr, "Error: Invalid syntax for delete.\n");
+        return 1;
+    }
+
+    const Backend_t *backend = Backend_open(imagefile);
+    if (!backend) {
+        return 1;
+    }
+
+    if (backend->remove(name, block) != OK) {
+        fprintf(stderr, "Error: Failed to delete file %s.\n", command);
+        backend->end();
+        return 1;
+    }
+
+    printf("File %s deleted successfully.\n", command);
+    backend->end();
+    return 0;
+}
+
+int handle_stat(const char *imagefile, const char *input) {
+    char name[MAX_NAME_SIZE];
+    uint16_t block;
+    FileEntry_t fe;
+
+    if (!parse_file_args(input, name, &block, NULL, 0)) {
+        fprintf(stderr, "Error: Invalid syntax for stat.\n");
+        return 1;
+    }
+
+    const Backend_t *backend = Backend_open(imagefile);
+    if (!backend) {
+        return 1;
+    }
+
+    if (backend->stat(name, block, &fe) != OK) {
+        fprintf(stderr, "Error: File %s is not found.\n", input);
+        backend->end();
+        return 1;
+    }
+    backend->end();
+
+    printf("Name   %.*s\n", MAX_NAME_SIZE, fe.name);
+    printf("Block  %d, %d sectors\n", fe.block, FE_SECTORS(&fe));
+    printf("Start  $%04X\n", fe.start);
+    printf("Size   %d\n", fe.size);
+    if (fe.flags & FE_FLAG_LZ) {
+        printf("Expand %d\n", fe.xsize);
+    }
+    if (fe.flags & FE_FLAG_CRC) {
+        printf("CRC    %08X\n", fe.crc);
+    }
+    printf("Flags  %02X\n", fe.flags);
+    return 0;
+}
+
+// Image file or serial port, the error is reported
+const Backend_t *Backend_open(const char *target) {
+    const Backend_t *backend = strncmp(target, "/dev/", 5) == 0 ? &serial_backend : &image_backend;
+    if (!backend->begin(target)) {
+        fprintf(stderr, "Error: Failed to open %s.\n", target);
+        return NULL;
+    }
+    return backend;
+}
+
+// Command line addresses a file by name or "#block", block in decimal, nargs hex values follow: "name#a#b"
+int parse_file_args(const char *input, char *name, uint16_t *pblock, uint16_t *args, int nargs) {
+    char *end = (char *)input;
+    *pblock = 0;
+    name[0] = '\0';
+    if (*input == '#') {
+        *pblock = (uint16_t) strtoul(input + 1, &end, 10);
+    } else {
+        size_t len = strcspn(input, "#");
+        if (len == 0 || len >= MAX_NAME_SIZE) {
+            return 0;
+        }
+        memcpy(name, input, len);
+        name[len] = '\0';
+        end += len;
+    }
+    for (int i = 0; i < nargs; i++) {
+        if (*end != '#') {
+            return 0;
+        }
+        args[i] = (uint16_t) strtoul(end + 1, &end, 16);
+    }
+    return *end == '\0';
+}
@@ -0,0 +1,172 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <string.h>
+#include "fileserver.h"
+#include "simplefs.h"
+#include "uart.h"
+#include "iostat.h"
+
+#if FILE_SERVER
+#define PATTERN_SIZE    32      // LIST pattern is kept at the end of buff, entries are read to its beginning
+
+static uint8_t sum;
+
+static uint8_t receive() {
+  uint8_t value = uart_receive_blocking();
+  sum += value;
+  return value;
+}
+
+static void transmit(uint8_t value) {
+  sum += value;
+  uart_transmit(value);
+}
+
+static void reply(uint8_t status, const uint8_t *data, uint16_t len) {
+  sum = 0;
+  transmit(status);
+  transmit(len & 0xff);
+  transmit(len >> 8);
+  while (len--) {
+    transmit(*data++);
+  }
+  uart_transmit(-sum);
+}
+
+static uint16_t get_uint16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+// Payload is a file address and nargs 16-bit values, name is empty if the file is addressed by block
+static bool parse_file(const uint8_t *p, uint8_t size, char *name, uint16_t *pblock, uint16_t *args, uint8_t nargs) {
+  uint8_t len = p[0];
+  uint8_t n = 1 + (len ? len : 2);
+  if (len >= MAX_NAME_SIZE || size != n + 2 * nargs) {
+    return false;
+  }
+  memcpy(name, p + 1, len);
+  name[len] = '\0';
+  *pblock = len ? 0 : get_uint16(p + 1);
+  for (uint8_t i = 0; i < nargs; i++, n += 2) {
+    args[i] = get_uint16(p + n);
+  }
+  return true;
+}
+
+static void list_files(uint8_t *buff, uint8_t size) {
+  char *pattern = (char *)buff + PAGE_SIZE - PATTERN_SIZE;
+  uint8_t len = buff[0] < PATTERN_SIZE ? buff[0] : PATTERN_SIZE - 1;
+  if (size != 1 + buff[0]) {
+    reply(FS_FRAME_ERROR, NULL, 0);
+    return;
+  }
+  memmove(pattern, buff + 1, len);
+  pattern[len] = '\0';
+  uint16_t block = 0;
+  // Any status ends the list, as it does for CMD_LIST
+  while (SimpleFS_listFiles(buff, &block, pattern) == OK) {
+    reply(OK, buff, sizeof(FileEntry_t));
+    block = SimpleFS_nextBlock(buff, block);
+  }
+  reply(OK, NULL, 0);
+}
+
+static void read_file(uint8_t *buff, const char *name, uint16_t block) {
+  uint16_t size;
+  uint8_t status = *name ? SimpleFS_readFileByName(buff, name, &size)
+                         : SimpleFS_readFileByBlockNo(buff, block, &size);
+  while (status == OK && size) {
+    uint16_t n = size < PAGE_SIZE ? size : PAGE_SIZE;
+    reply(OK, buff, n);
+    size -= n;
+    if (size) {
+      status = SimpleFS_readFileNextPage(buff);
+    }
+  }
+  reply(status == OK ? SimpleFS_verifyFile() : status, NULL, 0);
+}
+
+// Every data frame fills the rest of the page, it is consumed whole even if it is wrong to keep frames in sync
+static void write_file(uint8_t *buff, const char *name, const uint16_t *args) {
+  uint16_t block = 0, size;
+  uint8_t status = SimpleFS_createFileEntry(buff, name, args[0], args[1], &block, &size);
+  if (status == OK && args[2]) {
+    FileEntry_t *fe = (FileEntry_t *)buff;
+    fe->flags |= FE_FLAG_LZ;
+    fe->xsize = args[2];
+  }
+  reply(status, (uint8_t *)&block, sizeof(block));
+  uint16_t idx = sizeof(FileEntry_t);
+  while (status == OK && size) {
+    uint16_t room = (size < PAGE_SIZE ? size : PAGE_SIZE) - idx;
+    sum = 0;
+    uint16_t len = receive();
+    len |= receive() << 8;
+    for (uint16_t i = 0; i < len; i++) {
+      uint8_t value = receive();
+      if (i < room) {
+        buff[idx + i] = value;
+      }
+    }
+    receive();
+    if (sum || len != room) {
+      status = FS_FRAME_ERROR;  // file is left without CRC, it reads as CRC_MISMATCH
+    } else {
+      status = SimpleFS_writeFile(buff);
+      size -= idx + room;
+      idx = 0;
+    }
+    reply(status, NULL, 0);
+  }
+}
+
+void FileServer_request(uint8_t *buff) {
+  IoStat_begin(IO_OTHER);
+  sum = 0;
+  uint8_t op = receive();
+  uint8_t size = receive();
+  for (uint8_t i = 0; i < size; i++) {
+    buff[i] = receive();
+  }
+  receive();
+  if (sum) {
+    reply(FS_FRAME_ERROR, NULL, 0);
+    return;
+  }
+  if (op == FS_LIST) {
+    list_files(buff, size);
+    return;
+  }
+
+  char name[MAX_NAME_SIZE];
+  uint16_t block, args[3];
+  uint8_t nargs = op == FS_WRITE ? 3 : 0;
+  if (!parse_file(buff, size, name, &block, args, nargs)) {
+    reply(INVALID_DATA, NULL, 0);
+    return;
+  }
+  uint8_t status;
+  switch (op) {
+    case FS_READ:
+      read_file(buff, name, block);
+      break;
+    case FS_WRITE:
+      write_file(buff, name, args);
+      break;
+    case FS_DELETE:
+      status = *name ? SimpleFS_deleteFileByName(buff, name) : SimpleFS_deleteFileByBlockNo(buff, block);
+      reply(status, NULL, 0);
+      break;
+    case FS_STAT:
+      status = SimpleFS_statFile(buff, name, block);
+      reply(status, buff, status == OK ? sizeof(FileEntry_t) : 0);
+      break;
+    default:
+      reply(FS_FRAME_ERROR, NULL, 0);
+      break;
+  }
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "backend.h"
+#include "w25q64fv.h"
+#include "iostat.h"
+
+static bool image_begin(const char *target) {
+    return W25Q64FV_begin(target) == W25Q64FV_OK;
+}
+
+static void image_end() {
+    W25Q64FV_end();
+}
+
+static uint8_t image_list(const char *pattern, void (*entry)(const FileEntry_t *fe)) {
+    uint8_t buffer[PAGE_SIZE];
+    uint16_t block = 0;
+    IoStat_begin(IO_LIST);
+    // Image may be smaller than the chip, reading past its end ends the list too
+    while (SimpleFS_listFiles(buffer, &block, pattern) == OK) {
+        entry((FileEntry_t *)buffer);
+        block = SimpleFS_nextBlock(buffer, block);
+    }
+    return OK;
+}
+
+static uint8_t image_read(const char *name, uint16_t block, uint8_t *buffer, uint16_t *psize) {
+    IoStat_begin(IO_OPEN);
+    uint8_t status = *name ? SimpleFS_readFileByName(buffer, name, psize)
+                           : SimpleFS_readFileByBlockNo(buffer, block, psize);
+    uint8_t *ptr = buffer + PAGE_SIZE;  // we have alread read 1st buffer
+    IoStat_begin(IO_READ);
+    for (uint16_t current_size = PAGE_SIZE; status == OK && current_size < *psize; current_size += PAGE_SIZE) {
+        status = SimpleFS_readFileNextPage(ptr);
+        ptr += PAGE_SIZE;
+    }
+    IoStat_begin(IO_VERIFY);
+    return status == OK ? SimpleFS_verifyFile() : status;
+}
+
+static uint8_t image_write(const char *name, uint16_t start, uint16_t xsize, const uint8_t *data, uint16_t size, uint16_t *pblock) {
+    uint8_t buffer[BLOCK_SIZE + PAGE_SIZE];
+    uint16_t total;
+    *pblock = 0;
+    memset(buffer, 0xFF, BLOCK_SIZE);
+    IoStat_begin(IO_CREATE);
+    uint8_t status = SimpleFS_createFileEntry(buffer, name, start, size, pblock, &total);
+    if (status != OK) {
+        return status;
+    }
+    if (xsize) {
+        FileEntry_t *fe = (FileEntry_t *)buffer;
+        fe->flags |= FE_FLAGS_VALID | FE_FLAG_LZ;
+        fe->xsize = xsize;
+    }
+    memcpy(buffer + sizeof(FileEntry_t), data, size);
+
+    uint8_t *ptr = buffer;
+    IoStat_begin(IO_WRITE);
+    for (int32_t size_written = 0; status == OK && size_written < total; size_written += PAGE_SIZE) {
+        status = SimpleFS_writeFile(ptr);
+        ptr += PAGE_SIZE;
+    }
+    return status;
+}
+
+static uint8_t image_remove(const char *name, uint16_t block) {
+    uint8_t buffer[PAGE_SIZE];
+    IoStat_begin(IO_DELETE);
+    return *name ? SimpleFS_deleteFileByName(buffer, name) : SimpleFS_deleteFileByBlockNo(buffer, block);
+}
+
+static uint8_t image_stat(const char *name, uint16_t block, FileEntry_t *fe) {
+    uint8_t buffer[PAGE_SIZE];
+    IoStat_begin(IO_STAT);
+    uint8_t status = SimpleFS_statFile(buffer, name, block);
+    memcpy(fe, buffer, sizeof(FileEntry_t));
+    return status;
+}
+
+const Backend_t image_backend = {
+    image_begin, image_end, image_list, image_read, image_write, image_remove, image_stat
+};
@@ -0,0 +1,116 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+
+#define HASH_BITS   12
+#define MAX_CHAIN   256
+
+static uint16_t hash(const uint8_t *p) {
+    return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & ((1 << HASH_BITS) - 1);
+}
+
+static size_t flush_literals(const uint8_t *src, size_t from, size_t to, uint8_t *dst, size_t out) {
+    while (from < to) {
+        size_t n = to - from;
+        if (n > LZ_MAX_LITERALS) {
+            n = LZ_MAX_LITERALS;
+        }
+        dst[out++] = (uint8_t)(n - 1);
+        memcpy(dst + out, src + from, n);
+        out += n;
+        from += n;
+    }
+    return out;
+}
+
+// Greedy compression with hash chains. dst must hold LZ_MAX_COMPRESSED_SIZE(size) bytes
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst) {
+    int32_t head[1 << HASH_BITS];
+    int32_t *prev = (int32_t *)malloc((size ? size : 1) * sizeof(int32_t));
+    if (!prev) {
+        return 0;
+    }
+    for (int i = 0; i < (1 << HASH_BITS); i++) {
+        head[i] = -1;
+    }
+
+    size_t out = 0, pos = 0, literals = 0;
+    while (pos < size) {
+        size_t best_len = 0, best_dist = 0;
+        if (pos + LZ_MIN_MATCH <= size) {
+            size_t max_len = size - pos < LZ_MAX_MATCH ? size - pos : LZ_MAX_MATCH;
+            int32_t candidate = head[hash(src + pos)];
+            for (int chain = 0; candidate >= 0 && chain < MAX_CHAIN; chain++) {
+                size_t len = 0;
+                while (len < max_len && src[candidate + len] == src[pos + len]) {
+                    len++;
+                }
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = pos - candidate;
+                    if (len == max_len) {
+                        break;
+                    }
+                }
+                candidate = prev[candidate];
+            }
+        }
+
+        size_t advance = 1;
+        if (best_len >= LZ_MIN_MATCH) {
+            out = flush_literals(src, literals, pos, dst, out);
+            dst[out++] = 0x80 | (uint8_t)(best_len - LZ_MIN_MATCH);
+            dst[out++] = best_dist & 0xff;
+            dst[out++] = (best_dist >> 8) & 0xff;
+            advance = best_len;
+            literals = pos + best_len;
+        }
+        // index every position we step over
+        for (size_t end = pos + advance; pos < end; pos++) {
+            if (pos + 3 <= size) {
+                uint16_t h = hash(src + pos);
+                prev[pos] = head[h];
+                head[h] = (int32_t)pos;
+            }
+        }
+    }
+    out = flush_literals(src, literals, size, dst, out);
+    free(prev);
+    return out;
+}
+
+// Returns number of expanded bytes, 0 if stream is corrupted or does not fit
+size_t lz_expand(const uint8_t *src, size_t size, uint8_t *dst, size_t max_size) {
+    size_t in = 0, out = 0;
+    while (in < size) {
+        uint8_t token = src[in++];
+        if (token & 0x80) {
+            if (in + 2 > size) {
+                return 0;
+            }
+            size_t len = (token & 0x7f) + LZ_MIN_MATCH;
+            size_t dist = src[in] | (src[in + 1] << 8);
+            in += 2;
+            if (dist == 0 || dist > out || out + len > max_size) {
+                return 0;
+            }
+            for (size_t i = 0; i < len; i++, out++) {
+                dst[out] = dst[out - dist];
+            }
+        } else {
+            size_t len = token + 1;
+            if (in + len > size || out + len > max_size) {
+                return 0;
+            }
+            memcpy(dst + out, src + in, len);
+            in += len;
+            out += len;
+        }
+    }
+    return out;
+}
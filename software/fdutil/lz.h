@@ -0,0 +1,23 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ/RLE stream, simple enough to be expanded by 6502 straight into target memory.
+// Back references point into already expanded data, so no window buffer is needed.
+//   0nnnnnnn            - n+1 literal bytes follow
+//   1nnnnnnn lo hi      - copy n+4 bytes from distance hi:lo back, distance 1 repeats a byte (RLE)
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_MATCH    (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+
+// Worst case size of compressed data, all literals
+#define LZ_MAX_COMPRESSED_SIZE(size) ((size) + (size) / LZ_MAX_LITERALS + 1)
+
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst);
+size_t lz_expand(const uint8_t *src, size_t size, uint8_t *dst, size_t max_size);
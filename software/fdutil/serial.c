@@ -0,0 +1,203 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+// Client of the firmware file server, see fileserver.h for the frames
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>   // termios2, 250000 baud is not a standard rate
+#include "backend.h"
+#include "fileserver.h"
+
+#define SERIAL_BAUD     250000
+#define SERIAL_TIMEOUT  5000    // ms, erasing a 32K block takes up to 1.6s
+
+static int fd = -1;
+
+static bool serial_begin(const char *target) {
+    fd = open(target, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return false;
+    }
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio)) {
+        close(fd);
+        return false;
+    }
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    tio.c_ispeed = tio.c_ospeed = SERIAL_BAUD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    ioctl(fd, TCSETS2, &tio);
+    ioctl(fd, TCFLSH, TCIFLUSH);    // drop boot and debug output of the device
+    return true;
+}
+
+static void serial_end() {
+    close(fd);
+    fd = -1;
+}
+
+static bool receive(uint8_t *data, size_t len) {
+    while (len) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, SERIAL_TIMEOUT) <= 0) {
+            return false;
+        }
+        ssize_t n = read(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static uint8_t checksum(const uint8_t *data, size_t len) {
+    uint8_t sum = 0;
+    while (len--) {
+        sum += *data++;
+    }
+    return sum;
+}
+
+// Frame is sent at once, sum is appended, the room for it is reserved by the caller
+static bool send_frame(uint8_t *frame, size_t len) {
+    frame[len] = -checksum(frame, len);
+    return write(fd, frame, len + 1) == (ssize_t)(len + 1);
+}
+
+// Reply frame, data gets up to max bytes, *plen is set to the length of data. FS_FRAME_ERROR if it is broken
+static uint8_t receive_reply(uint8_t *data, uint16_t max, uint16_t *plen) {
+    uint8_t header[3], sum;
+    if (!receive(header, sizeof(header))) {
+        return FS_FRAME_ERROR;
+    }
+    uint16_t len = header[1] | header[2] << 8;
+    if (len > max || !receive(data, len) || !receive(&sum, 1)) {
+        return FS_FRAME_ERROR;
+    }
+    if ((uint8_t)(checksum(header, sizeof(header)) + checksum(data, len) + sum)) {
+        return FS_FRAME_ERROR;
+    }
+    *plen = len;
+    return header[0];
+}
+
+static uint8_t put_uint16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+    return 2;
+}
+
+// 'F', op, len and payload with the file address, args follow
+static bool send_request(uint8_t op, const char *name, uint16_t block, const uint16_t *args, int nargs) {
+    uint8_t frame[3 + MAX_NAME_SIZE + 6 + 1];
+    uint8_t n = 3;
+    uint8_t len = strlen(name);
+    frame[0] = 'F';
+    frame[1] = op;
+    frame[n++] = len;
+    if (len) {
+        memcpy(frame + n, name, len);
+        n += len;
+    } else {
+        n += put_uint16(frame + n, block);
+    }
+    for (int i = 0; i < nargs; i++) {
+        n += put_uint16(frame + n, args[i]);
+    }
+    frame[2] = n - 3;
+    ioctl(fd, TCFLSH, TCIFLUSH);
+    return write(fd, frame, 1) == 1 && send_frame(frame + 1, n - 1);
+}
+
+static uint8_t serial_list(const char *pattern, void (*entry)(const FileEntry_t *fe)) {
+    uint8_t frame[4 + 255 + 1];
+    size_t len = strlen(pattern) < 254 ? strlen(pattern) : 254;
+    frame[0] = 'F';
+    frame[1] = FS_LIST;
+    frame[2] = 1 + len;
+    frame[3] = len;
+    memcpy(frame + 4, pattern, len);
+    ioctl(fd, TCFLSH, TCIFLUSH);
+    if (write(fd, frame, 1) != 1 || !send_frame(frame + 1, 3 + len)) {
+        return FS_FRAME_ERROR;
+    }
+    FileEntry_t fe;
+    uint16_t n;
+    uint8_t status;
+    while ((status = receive_reply((uint8_t *)&fe, sizeof(fe), &n)) == OK && n == sizeof(fe)) {
+        entry(&fe);
+    }
+    return status;
+}
+
+static uint8_t serial_read(const char *name, uint16_t block, uint8_t *buffer, uint16_t *psize) {
+    if (!send_request(FS_READ, name, block, NULL, 0)) {
+        return FS_FRAME_ERROR;
+    }
+    uint16_t n;
+    uint8_t status;
+    *psize = 0;
+    while ((status = receive_reply(buffer + *psize, BLOCK_SIZE - *psize, &n)) == OK && n) {
+        *psize += n;
+    }
+    return status;
+}
+
+static uint8_t serial_write(const char *name, uint16_t start, uint16_t xsize, const uint8_t *data, uint16_t size, uint16_t *pblock) {
+    uint16_t args[3] = { start, size, xsize }, n;
+    if (!send_request(FS_WRITE, name, 0, args, 3)) {
+        return FS_FRAME_ERROR;
+    }
+    uint8_t status = receive_reply((uint8_t *)pblock, sizeof(*pblock), &n);
+    // Every data frame fills the rest of a page as in the device, the first page holds FileEntry_t
+    uint8_t frame[2 + PAGE_SIZE + 1];
+    uint32_t total = sizeof(FileEntry_t) + size;
+    uint16_t idx = sizeof(FileEntry_t);
+    while (status == OK && total) {
+        uint16_t len = (total < PAGE_SIZE ? total : PAGE_SIZE) - idx;
+        put_uint16(frame, len);
+        memcpy(frame + 2, data, len);
+        if (!send_frame(frame, 2 + len)) {
+            return FS_FRAME_ERROR;
+        }
+        status = receive_reply(NULL, 0, &n);
+        data += len;
+        total -= idx + len;
+        idx = 0;
+    }
+    return status;
+}
+
+static uint8_t serial_remove(const char *name, uint16_t block) {
+    uint16_t n;
+    if (!send_request(FS_DELETE, name, block, NULL, 0)) {
+        return FS_FRAME_ERROR;
+    }
+    return receive_reply(NULL, 0, &n);
+}
+
+static uint8_t serial_stat(const char *name, uint16_t block, FileEntry_t *fe) {
+    uint16_t n;
+    if (!send_request(FS_STAT, name, block, NULL, 0)) {
+        return FS_FRAME_ERROR;
+    }
+    uint8_t status = receive_reply((uint8_t *)fe, sizeof(*fe), &n);
+    return status == OK && n != sizeof(*fe) ? FS_FRAME_ERROR : status;
+}
+
+const Backend_t serial_backend = {
+    serial_begin, serial_end, serial_list, serial_read, serial_write, serial_remove, serial_stat
+};
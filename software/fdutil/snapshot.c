@@ -0,0 +1,28 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include "snapshot.h"
+
+// Image has no EEPROM, the snapshot is never valid, so SimpleFS scans the directory
+bool Snapshot_begin(uint8_t *buff) {
+    return false;
+}
+
+bool Snapshot_used(uint16_t block32) {
+    return true;
+}
+
+uint16_t Snapshot_cursor() {
+    return 0;
+}
+
+void Snapshot_store(const uint8_t *used, uint16_t cursor) {
+}
+
+void Snapshot_commit(uint16_t block32, bool used, uint16_t cursor) {
+}
+
+void Snapshot_invalidate() {
+}
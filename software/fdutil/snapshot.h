@@ -0,0 +1,22 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "defs.h"
+
+// Mount snapshot kept in EEPROM: a bit per 32K block holding any file and the cursor, no sector
+// below it is free. It is trusted while its generation matches the marker in flash security register 1,
+// both advance on every create and delete. Flash changed by other means leaves the snapshot stale
+#define SNAPSHOT_MAX_BLOCKS     1024    // W25Q256, the bitmap takes 128 bytes of EEPROM
+
+bool Snapshot_begin(uint8_t *buff);
+bool Snapshot_used(uint16_t block32);
+uint16_t Snapshot_cursor();
+void Snapshot_store(const uint8_t *used, uint16_t cursor);
+void Snapshot_commit(uint16_t block32, bool used, uint16_t cursor);
+void Snapshot_invalidate();
@@ -0,0 +1,53 @@
+/*
+Flash Disk Util
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "uart.h"
+
+// UART of the MCU is a file descriptor, fdserver sets it to the master side of a PTY
+int uart_fd = -1;
+volatile UartErrors_t uart_errors;
+
+void uart_init(unsigned int ubrr) {
+}
+
+void uart_set_rate(unsigned int ubrr, char double_speed) {
+}
+
+void uart_transmit(unsigned char data) {
+    if (write(uart_fd, &data, 1) != 1) {
+        perror("uart");
+        exit(1);
+    }
+}
+
+void uart_transmit_string(const char *str) {
+    while (*str) {
+        uart_transmit(*str++);
+    }
+}
+
+void uart_transmit_string_P(const char *str) {
+    uart_transmit_string(str);
+}
+
+char uart_available(void) {
+    return 1;
+}
+
+unsigned char uart_receive(void) {
+    return uart_receive_blocking();
+}
+
+unsigned char uart_receive_blocking(void) {
+    unsigned char data;
+    if (read(uart_fd, &data, 1) != 1) {
+        perror("uart");
+        exit(1);
+    }
+    return data;
+}
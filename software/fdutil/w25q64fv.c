@@ -7,10 +7,12 @@ Copyright (c) 2025 Arvid Juskaitis
 #include <stdlib.h>
 #include <string.h>
 #include "w25q64fv.h"
+#include "iostat.h"
 
 #define FLASH_SIZE (8 * 1024 * 1024) // 8 MB size of W25Q64
 #define PAGE_SIZE 256
 #define BLOCK_SIZE_32K (32 * 1024) // 32 KB block size
+#define SECTOR_SIZE_4K (4 * 1024) // 4 KB sector size
 
 
 static FILE *flash_file = NULL;
@@ -99,22 +101,177 @@ W25Q64FV_status_t W25Q64FV_begin(const char* filename) {
     return W25Q64FV_OK;
 }
 
+// NOR flash model, off by default, so the image stays a plain file host commands could rewrite.
+// Programming only clears bits and wraps within the page, erases wear sectors, every command takes
+// its SPI transfer and datasheet busy time on a virtual clock, commands issued while busy fail
+#define SPI_BYTE_NS     4000    // ATmega8515 SPI at F_CPU/4, 8 bits at 2 MHz
+#define POLL_NS         (2 * SPI_BYTE_NS)   // read status register 1
+#define BYTE_PROGRAM_NS 30000   // tBP1, first byte
+#define NEXT_BYTE_NS    2500    // tBP2, each following byte
+#define PAGE_PROGRAM_NS 700000  // tPP
+#define ERASE_4K_NS     45000000ULL     // tSE
+#define ERASE_32K_NS    120000000ULL    // tBE1
+#define ERASE_CHIP_NS   20000000000ULL  // tCE
+
+static bool model = false;
+static uint64_t now_ns;         // virtual clock
+static uint64_t busy_until_ns;
+static uint64_t spi_ns, busy_ns;    // time spent transferring and waiting for the chip
+static uint32_t *wear;          // erase count of every 4K sector
+static uint32_t sectors;
+static uint32_t unerased;       // programs which tried to set bits of not erased bytes
+static uint32_t first_unerased;
+
+void W25Q64FV_model(bool enable) {
+    model = enable;
+}
+
+static void model_transfer(uint32_t bytes) {
+    now_ns += (uint64_t)bytes * SPI_BYTE_NS;
+    spi_ns += (uint64_t)bytes * SPI_BYTE_NS;
+}
+
+// Write enable is sent and waited for before every program and erase, as the firmware does
+static W25Q64FV_status_t model_command(uint32_t bytes) {
+    if (W25Q64FV_busy()) {
+        return W25Q64FV_BUSY;
+    }
+    model_transfer(1);
+    W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+    model_transfer(bytes);
+    return W25Q64FV_OK;
+}
+
+static void model_busy(uint64_t duration_ns) {
+    busy_until_ns = now_ns + duration_ns;
+}
+
+// Bytes past the end of the page wrap to its beginning, only the last 256 bytes are programmed
+static W25Q64FV_status_t model_program(uint32_t start_address, const byte *buffer, uint16_t size) {
+    uint32_t page_address = start_address & ~(uint32_t)(PAGE_SIZE - 1);
+    if (page_address + PAGE_SIZE > current_size) {
+        return W25Q64FV_NOT_VALID;
+    }
+    W25Q64FV_status_t status = model_command(4 + size);
+    if (status != W25Q64FV_OK) {
+        return status;
+    }
+    byte page[PAGE_SIZE];
+    fseek(flash_file, page_address, SEEK_SET);
+    fread(page, 1, PAGE_SIZE, flash_file);
+    uint16_t skip = size > PAGE_SIZE ? size - PAGE_SIZE : 0;
+    bool violation = false;
+    for (uint16_t i = skip; i < size; i++) {
+        uint8_t offset = (start_address + i) & (PAGE_SIZE - 1);
+        violation |= (page[offset] & buffer[i]) != buffer[i];
+        page[offset] &= buffer[i];
+    }
+    if (violation && !unerased++) {
+        first_unerased = start_address;
+    }
+    fseek(flash_file, page_address, SEEK_SET);
+    fwrite(page, 1, PAGE_SIZE, flash_file);
+    fflush(flash_file);
+    size -= skip;
+    uint64_t duration = BYTE_PROGRAM_NS + (uint64_t)(size - 1) * NEXT_BYTE_NS;
+    model_busy(duration < PAGE_PROGRAM_NS ? duration : PAGE_PROGRAM_NS);
+    IOSTAT_PROGRAM(size);
+    return W25Q64FV_OK;
+}
+
+// Chip erase is sent without address
+static W25Q64FV_status_t model_erase(uint32_t address, uint32_t size, uint8_t address_bytes, uint64_t duration_ns) {
+    W25Q64FV_status_t status = model_command(address_bytes);
+    if (status != W25Q64FV_OK) {
+        return status;
+    }
+    if (!wear) {
+        sectors = current_size / SECTOR_SIZE_4K;
+        wear = calloc(sectors, sizeof(uint32_t));
+        if (!wear) {
+            return W25Q64FV_NOT_VALID;
+        }
+    }
+    for (uint32_t sector = address / SECTOR_SIZE_4K; sector < (address + size) / SECTOR_SIZE_4K; sector++) {
+        wear[sector]++;
+    }
+    model_busy(duration_ns);
+    return W25Q64FV_OK;
+}
+
+// Simulated time and wear of the workload, i.e. of the command run
+void W25Q64FV_model_report(FILE *out) {
+    if (!model) {
+        return;
+    }
+    uint32_t erased = 0, erases = 0, max_wear = 0, max_sector = 0;
+    for (uint32_t i = 0; i < sectors; i++) {
+        erased += wear[i] != 0;
+        erases += wear[i];
+        if (wear[i] > max_wear) {
+            max_wear = wear[i];
+            max_sector = i;
+        }
+    }
+    fprintf(out, "flash time=%.3f ms spi=%.3f ms busy=%.3f ms\n", now_ns / 1e6, spi_ns / 1e6, busy_ns / 1e6);
+    fprintf(out, "flash wear erases=%u sectors=%u", erases, erased);
+    if (max_wear) {
+        fprintf(out, " max=%u at sector %u", max_wear, max_sector);
+    }
+    fprintf(out, "\n");
+    if (unerased) {
+        fprintf(out, "flash %u programs of not erased bytes, first at 0x%06x\n", unerased, first_unerased);
+    }
+}
+
 // Write a page of data to the simulated flash
 W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer) {
     if (!flash_file || start_address >= current_size || !buffer) {
         return W25Q64FV_NOT_VALID;
     }
+    if (model) {
+        return model_program(start_address, buffer, PAGE_SIZE);
+    }
     fseek(flash_file, start_address, SEEK_SET);
     fwrite(buffer, 1, PAGE_SIZE, flash_file);
     fflush(flash_file); // Ensure data is written to disk
+    IOSTAT_PROGRAM(PAGE_SIZE);
+    return W25Q64FV_OK;
+}
+
+// Write bytes within a page of the simulated flash
+W25Q64FV_status_t W25Q64FV_write_bytes(uint32_t start_address, byte *buffer, uint16_t size) {
+    if (model && flash_file && buffer) {
+        return model_program(start_address, buffer, size);
+    }
+    if (!flash_file || start_address + size > current_size || !buffer) {
+        return W25Q64FV_NOT_VALID;
+    }
+    fseek(flash_file, start_address, SEEK_SET);
+    fwrite(buffer, 1, size, flash_file);
+    fflush(flash_file); // Ensure data is written to disk
+    IOSTAT_PROGRAM(size);
     return W25Q64FV_OK;
 }
 
 // Read a page of data from the simulated flash
 W25Q64FV_status_t W25Q64FV_read_page(uint32_t start_address, byte *buffer, uint16_t size) {
-    if (!flash_file || start_address + size > current_size || !buffer) {
+    if (!flash_file || start_address >= current_size || !buffer) {
         return W25Q64FV_NOT_VALID;
     }
+    if (model) {
+        if (W25Q64FV_busy()) {
+            return W25Q64FV_BUSY;
+        }
+        model_transfer(4 + size);
+    }
+    IOSTAT_READ(size);
+    // Ranged reads may start mid-page close to the end of the image
+    uint32_t available = current_size - start_address;
+    if (size > available) {
+        memset(buffer + available, 0xFF, size - available);
+        size = available;
+    }
     fseek(flash_file, start_address, SEEK_SET);
     fread(buffer, 1, size, flash_file);
     return W25Q64FV_OK;
@@ -122,23 +279,59 @@ W25Q64FV_status_t W25Q64FV_read_page(uint32_t start_address, byte *buffer, uint1
 
 // Erase the entire chip by setting it to 0xFF
 W25Q64FV_status_t W25Q64FV_erase_chip(bool hold) {
-    (void)hold; // Unused
     if (!flash_file) {
         return W25Q64FV_NOT_VALID;
     }
+    if (model) {
+        W25Q64FV_status_t status = model_erase(0, current_size, 0, ERASE_CHIP_NS);
+        if (status != W25Q64FV_OK) {
+            return status;
+        }
+    }
     fseek(flash_file, 0, SEEK_SET);
     byte empty[FLASH_SIZE];
     memset(empty, 0xFF, current_size);
     fwrite(empty, 1, current_size, flash_file);
     fflush(flash_file);
-    return W25Q64FV_OK;
+    IOSTAT_ERASE();
+    return model && hold ? W25Q64FV_wait_until_free(W25Q64FV_CHIP_ERASE_TIMEOUT) : W25Q64FV_OK;
+}
+
+W25Q64FV_status_t W25Q64FV_erase_sector_4k(uint32_t sector_address, bool hold) {
+    if (!flash_file || sector_address >= current_size || sector_address % SECTOR_SIZE_4K != 0) {
+        return W25Q64FV_NOT_VALID; // Invalid address or uninitialized file
+    }
+    if (model) {
+        W25Q64FV_status_t status = model_erase(sector_address, SECTOR_SIZE_4K, 3, ERASE_4K_NS);
+        if (status != W25Q64FV_OK) {
+            return status;
+        }
+    }
+
+    // Fill the sector with 0xFF
+    byte empty[SECTOR_SIZE_4K];
+    memset(empty, 0xFF, SECTOR_SIZE_4K);
+
+    fseek(flash_file, sector_address, SEEK_SET);
+    if (fwrite(empty, 1, SECTOR_SIZE_4K, flash_file) != SECTOR_SIZE_4K) {
+        return W25Q64FV_COMMUNICATION_FAIL; // Write operation failed
+    }
+    IOSTAT_ERASE();
+
+    fflush(flash_file); // Ensure changes are written to the file
+    return model && hold ? W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT) : W25Q64FV_OK;
 }
 
 W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t block_address, bool hold) {
-    (void)hold; // Unused, for compatibility with hardware behavior
     if (!flash_file || block_address >= current_size || block_address % BLOCK_SIZE_32K != 0) {
         return W25Q64FV_NOT_VALID; // Invalid address or uninitialized file
     }
+    if (model) {
+        W25Q64FV_status_t status = model_erase(block_address, BLOCK_SIZE_32K, 3, ERASE_32K_NS);
+        if (status != W25Q64FV_OK) {
+            return status;
+        }
+    }
 
     // Move to the block address
     fseek(flash_file, block_address, SEEK_SET);
@@ -150,9 +343,19 @@ W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t block_address, bool hold) {
     if (fwrite(empty, 1, BLOCK_SIZE_32K, flash_file) != BLOCK_SIZE_32K) {
         return W25Q64FV_COMMUNICATION_FAIL; // Write operation failed
     }
+    IOSTAT_ERASE();
 
     fflush(flash_file); // Ensure changes are written to the file
-    return W25Q64FV_OK;
+    return model && hold ? W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT) : W25Q64FV_OK;
+}
+
+// Size of the smallest chip the image fits in, as if detected from JEDEC ID
+uint32_t W25Q64FV_capacity() {
+    uint8_t capacity = W25Q64FV_CAPACITY_8MB;
+    while (capacity < W25Q64FV_CAPACITY_32MB && current_size > (1UL << capacity)) {
+        capacity++;
+    }
+    return 1UL << capacity;
 }
 
 // Close the simulated flash file
@@ -164,11 +367,27 @@ W25Q64FV_status_t W25Q64FV_end() {
     return W25Q64FV_OK;
 }
 
+// Image is never busy unless modelled, a poll is counted where the device reads the status register at least once
 bool W25Q64FV_busy() {
-    return false;
+    IOSTAT_POLL();
+    if (model) {
+        model_transfer(2);
+    }
+    return now_ns < busy_until_ns;
 }
 
+// Clock jumps to the end of the pending operation, the firmware polls first at its expected completion
 W25Q64FV_status_t W25Q64FV_wait_until_free(unsigned long max_timeout_ms) {
+    if (now_ns < busy_until_ns) {
+        if (busy_until_ns - now_ns > max_timeout_ms * 1000000ULL) {
+            busy_ns += max_timeout_ms * 1000000ULL;
+            now_ns += max_timeout_ms * 1000000ULL;
+            return W25Q64FV_TIMEOUT;
+        }
+        busy_ns += busy_until_ns - now_ns;
+        now_ns = busy_until_ns;
+    }
+    W25Q64FV_busy();
     return W25Q64FV_OK;
 }
 
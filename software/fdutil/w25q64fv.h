@@ -7,6 +7,7 @@ Copyright (c) 2025 Arvid Juskaitis
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 
 /********** INSTRUCTION SETS **********/
@@ -58,6 +59,11 @@ Copyright (c) 2025 Arvid Juskaitis
   100000 // Chip erase timeout. Per spec, this is typically 20 seconds, at most
          // 100 seconds.
 
+/********** JEDEC CAPACITY CODES, log2 of size in bytes **********/
+#define W25Q64FV_CAPACITY_8MB  0x17 // W25Q64
+#define W25Q64FV_CAPACITY_16MB 0x18 // W25Q128
+#define W25Q64FV_CAPACITY_32MB 0x19 // W25Q256
+
 /// Default Status Return Enum
 typedef enum {
   W25Q64FV_OK = 0,             ///< Chip OK
@@ -72,14 +78,20 @@ typedef uint8_t byte;
 
 W25Q64FV_status_t W25Q64FV_init(const char *filename, short numberOfFiles);
 W25Q64FV_status_t W25Q64FV_begin(const char* filename);
+uint32_t W25Q64FV_capacity();
 W25Q64FV_status_t W25Q64FV_enable_writing();
 W25Q64FV_status_t W25Q64FV_disable_writing();
 W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer);
+W25Q64FV_status_t W25Q64FV_write_bytes(uint32_t start_address, byte *buffer, uint16_t size);
 W25Q64FV_status_t W25Q64FV_read_page(uint32_t start_address, byte *buffer, const uint16_t size);
+W25Q64FV_status_t W25Q64FV_erase_sector_4k(uint32_t sector_address, bool hold);
 W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t block_address, bool hold);
 W25Q64FV_status_t W25Q64FV_erase_chip(bool hold);
 W25Q64FV_status_t W25Q64FV_get_jedec(byte *manufacture_id, byte *memory_type, byte *capacity);
 bool W25Q64FV_busy();
 W25Q64FV_status_t  W25Q64FV_wait_until_free(unsigned long max_timeout);
 W25Q64FV_status_t W25Q64FV_end();
+// NOR flash model of the image, see w25q64fv.c
+void W25Q64FV_model(bool enable);
+void W25Q64FV_model_report(FILE *out);
 
@@ -0,0 +1,14 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected), same as zlib's crc32()
+#define CRC32_INIT  0xFFFFFFFFUL
+#define crc32_final(crc) ((crc) ^ 0xFFFFFFFFUL)
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint16_t size);
@@ -11,4 +11,44 @@ Copyright (c) 2025 Arvid Juskaitis
 #define READ            1
 #define WRITE           1
 #define DELETE          1
+#define CRC             1
 #define UNUSED          0
+
+// Optional parts are off by default, fdutil turns on the ones it shares with the firmware in its Makefile.
+// Cost is the growth of an -Os build of the defaults, check avr-size of the image when one is enabled
+#ifndef BULK_RATE
+#define BULK_RATE       0   // 'U' raises UART rate for bulk commands, which report UART time, requires BULK_TRANSFER,
+                            // ~0.6 KB of flash, 9 bytes of SRAM
+#endif
+#ifndef FLASH_AUTODETECT
+#define FLASH_AUTODETECT 0  // chip size from JEDEC ID, 4-byte addressing above 16 MB, otherwise W25Q64 geometry
+                            // is hard-coded, ~0.25 KB of flash, 10 bytes of SRAM
+#endif
+#ifndef UPDATE
+#define UPDATE          0   // requires WRITE and DELETE, ~1.4 KB of flash, 13 bytes of SRAM
+#endif
+#ifndef HANDLES
+#define HANDLES         0   // requires READ, ~0.7 KB of flash, 28 bytes of SRAM
+#endif
+#ifndef STATS
+#define STATS           0   // Timer1 counters, CMD_STATS, ~1.2 KB of flash, 63 bytes of SRAM
+#endif
+#ifndef TRACE
+#define TRACE           0   // requires STATS, bus event ring takes TRACE_SIZE * 5 bytes of SRAM
+#endif
+#ifndef SNAPSHOT
+#define SNAPSHOT        0   // mount snapshot in EEPROM, requires LIST, READ, WRITE and DELETE,
+                            // ~1.7 KB of flash, 3 bytes of SRAM, 134 bytes of EEPROM
+#endif
+#ifndef PREFETCH
+#define PREFETCH        0   // first page of the boot file is read ahead at power-up, requires READ,
+                            // ~0.4 KB of flash, 3 bytes of SRAM, 2 bytes of EEPROM
+#endif
+#ifndef FILE_SERVER
+#define FILE_SERVER     0   // file-level requests over UART, requires LIST, READ, WRITE and DELETE,
+                            // ~1.0 KB of flash, 1 byte of SRAM
+#endif
+#ifndef IOSTAT
+#define IOSTAT          0   // flash commands and bytes of the last command, ~0.2 KB of flash (~0.4 KB with STATS),
+                            // 19 bytes of SRAM
+#endif
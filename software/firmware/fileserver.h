@@ -0,0 +1,29 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// File-level requests over UART. Host sends 'F' and a request frame, MCU answers with reply frames:
+//   request - op, len, payload[len], sum
+//   reply   - status, len lo, len hi, data[len], sum
+//   data    - len lo, len hi, data[len], sum      ; file data sent by host for FS_WRITE
+// sum makes all bytes of the frame add up to 0. Payload addresses a file as a bus request does:
+// name length and name, or 0 and 2-byte block, 16-bit arguments follow, little endian
+#define FS_LIST     0x01    // len, pattern    - a frame per FileEntry_t, empty frame ends the list
+#define FS_READ     0x02    // file            - FileEntry_t and data in frames of up to PAGE_SIZE,
+                            //                   empty frame ends the file, its status is CRC check result
+#define FS_WRITE    0x03    // name, start, size, xsize - frame with block, then a data frame is expected
+                            //                   for every page, first one is shorter by FileEntry_t,
+                            //                   each one is written and answered with an empty frame.
+                            //                   xsize is the expanded size of LZ compressed data, 0 if not
+#define FS_DELETE   0x04    // file            - empty frame
+#define FS_STAT     0x0C    // file            - FileEntry_t
+
+#define FS_FRAME_ERROR  0xfe    // status, sum or size of the frame is wrong, or op is unknown
+
+void FileServer_request(uint8_t *buff);
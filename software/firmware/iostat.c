@@ -0,0 +1,20 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <string.h>
+#include "iostat.h"
+
+#if IOSTAT
+IoStat_t iostat[IOSTAT_SLOTS];
+uint8_t iostat_slot = IO_OTHER;
+
+void IoStat_begin(uint8_t op) {
+    if (IOSTAT_SLOTS == 1) {
+        memset(iostat, 0, sizeof(iostat));
+    } else {
+        iostat_slot = op < IOSTAT_SLOTS ? op : IO_OTHER;
+    }
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// Flash commands counted under the W25Q64FV_* API, so the cost of SimpleFS operations
+// could be compared between directory layouts and allocation strategies
+typedef struct {
+    uint16_t reads;         // read commands, security registers included
+    uint32_t read_bytes;
+    uint16_t programs;      // page and partial page programs
+    uint32_t program_bytes;
+    uint16_t erases;        // sector, block, chip and security register erases
+    uint32_t polls;         // status register reads, busy checks before commands and waits for completion
+} IoStat_t;
+
+// Operations the counters are kept for, fdutil sets them around SimpleFS calls
+typedef enum {
+    IO_OTHER = 0,   // not attributed, e.g. image conversion
+    IO_LIST,        // SimpleFS_listFiles, SimpleFS_nextBlock
+    IO_OPEN,        // lookup and the first page of a read
+    IO_READ,        // following pages
+    IO_VERIFY,      // CRC check
+    IO_CREATE,      // SimpleFS_createFileEntry, allocation
+    IO_WRITE,       // SimpleFS_writeFile
+    IO_DELETE,
+    IO_STAT,
+    IO_UPDATE,
+    IO_OPS
+} IoOp_t;
+
+// Firmware keeps the counters of the last command only, fdutil builds with IOSTAT_SLOTS=IO_OPS
+#ifndef IOSTAT_SLOTS
+#define IOSTAT_SLOTS    1
+#endif
+
+#if IOSTAT
+extern IoStat_t iostat[IOSTAT_SLOTS];
+extern uint8_t iostat_slot;
+
+// Flash commands which follow are counted for op, a single slot is cleared instead
+void IoStat_begin(uint8_t op);
+
+#define IOSTAT_READ(n)      (iostat[iostat_slot].reads++, iostat[iostat_slot].read_bytes += (n))
+#define IOSTAT_PROGRAM(n)   (iostat[iostat_slot].programs++, iostat[iostat_slot].program_bytes += (n))
+#define IOSTAT_ERASE()      (iostat[iostat_slot].erases++)
+#define IOSTAT_POLL()       (iostat[iostat_slot].polls++)
+#else
+#define IoStat_begin(op)    /**/
+#define IOSTAT_READ(n)      /**/
+#define IOSTAT_PROGRAM(n)   /**/
+#define IOSTAT_ERASE()      /**/
+#define IOSTAT_POLL()       /**/
+#endif
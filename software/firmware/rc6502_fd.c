@@ -12,13 +12,26 @@ PD6   - CLEWRITE-
 #include <stdbool.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
 #include <util/delay.h>
 #include "simplefs.h"
 #include "uart.h"
+#include "stats.h"
+#include "timer.h"
+#include "snapshot.h"
+#include "fileserver.h"
+#include "iostat.h"
 
 #define DEBUG   0
 #define BAUD 250000
 
+// Bulk transfers may raise the rate with U2X, see set_rate
+#define SAFE_UBRR           (F_CPU / 16 / BAUD - 1)
+#define RATE_PROBE_SIZE     8               // bytes echoed at the new rate before host confirms it
+#define RATE_TIMEOUT_MS     1000            // for every byte of the handshake
+#define RATE_IDLE_CYCLES    (2 * F_CPU)     // raised rate is dropped after 2s without UART commands
+
 /* ------------------------------------------------------------------------
  *  Protocol constants
  * ------------------------------------------------------------------------
@@ -36,6 +49,14 @@ PD6   - CLEWRITE-
 #define CMD_READ    0x02
 #define CMD_WRITE   0x03
 #define CMD_DELETE  0x04
+#define CMD_READ_RANGE  0x05
+#define CMD_UPDATE  0x06
+#define CMD_OPEN    0x07
+#define CMD_READ_NEXT   0x08
+#define CMD_SEEK    0x09
+#define CMD_CLOSE   0x0A
+#define CMD_STATS   0x0B
+#define CMD_WRITE_BLOCK 0x0C
 
 // Markers - Note by setting markers we're setting RDY_FLAG and clearing BSY_FLAG
 #define BODT        0x80
@@ -43,6 +64,19 @@ PD6   - CLEWRITE-
 #define ACK         0xA0
 #define NACK        0xAF
 
+// Longest request, see parse_request. Name of up to MAX_NAME_SIZE - 1 and two numbers fit easily
+#define MAX_REQUEST_SIZE    32
+
+// CMD_LIST record: header, block, start, size, [stored size], name without padding.
+// Header holds name length and flags, block is a delta from the previous record if it fits a byte
+#define LIST_LZ             0x80    // compressed, stored size follows expanded size
+#define LIST_BLOCK16        0x40    // 2-byte block number instead of 1-byte delta
+#define LIST_NAME_MASK      0x1f
+#define LIST_RECORD_MAX     (1 + 2 + 2 + 2 + 2 + MAX_NAME_SIZE - 1)
+// List pattern is kept at the end of buff, as many records as fit are packed in front of it
+#define LIST_BATCH_SIZE     (PAGE_SIZE - MAX_REQUEST_SIZE)
+#define LIST_PATTERN        ((char *)buff + LIST_BATCH_SIZE)
+
 /* ------------------------------------------------------------------------
  *  Ports / Bit manipulation
  * ------------------------------------------------------------------------
@@ -62,6 +96,14 @@ PD6   - CLEWRITE-
 #define SET_CLEWRITE()  (PORTD |= (1 << PD6))
 #define CLR_CLEWRITE()  (PORTD &= ~(1 << PD6))
 
+// Pulse which releases the latch, CPU may write the next byte right after it
+#define CLEWRITE_PULSE_US   2
+
+// Bytes written by CPU are queued by INT0, the main loop consumes them.
+// Single producer and single consumer, each side updates its own 8-bit index only
+#define EVENT_RING_SIZE     8   // power of 2
+#define EVENT_RING_MASK     (EVENT_RING_SIZE - 1)
+
 // State machine enumerations
 typedef enum {
     SM_IDLE = 0,            // Doing nothing, waiting for next command from CPU
@@ -72,28 +114,96 @@ typedef enum {
     SM_FINISH = 5,          // We are about to finish with current command
 } mcu_state_t;
 
+// Byte received from CPU is classified into an event, event_handlers is indexed by it
+typedef enum {
+    EV_DATA = 0,            // Data nibble
+    EV_RESET = 1,           // CMD_RESET
+    EV_COMMAND = 2,         // Any other command
+    EV_BODT = 3,
+    EV_EODT = 4,
+    EV_ACK = 5,
+    EV_NACK = 6,
+    EV_OTHER = 7,           // Some other status or control byte
+} mcu_event_t;
+
+// How a command replies once the request is processed
+typedef enum {
+    CMD_TYPE_NONE = 0,
+    CMD_TYPE_SEND = 1,      // BODT and data follows, EODT if failed
+    CMD_TYPE_RECEIVE = 2,   // ACK and data is expected from CPU, NACK if failed
+    CMD_TYPE_STATUS = 3,    // ACK or NACK
+} cmd_type_t;
+
+typedef struct {
+    bool (*begin)();        // processes request in buff
+    uint8_t type;           // cmd_type_t
+    uint8_t stats;          // latency histogram, STATS_OTHER if none
+} command_t;
+
 // global variables
-volatile uint8_t state = SM_IDLE;
-volatile uint8_t command = 0, ms_nibble = 0;
-volatile uint16_t block = 0;
-volatile bool handle_disk_data = false; // set true to request more data for CMD_LIST and CMD_READ, set true to flush data for CMD_WRITE
-volatile uint16_t buff_idx = 0, buff_max = 0, file_size = 0;
-volatile uint8_t buff[PAGE_SIZE];
-char buff_aux[MAX_NAME_SIZE];
+volatile uint8_t events[EVENT_RING_SIZE];
+volatile uint8_t event_head = 0;        // written by INT0 only
+volatile uint8_t event_tail = 0;        // written by main loop only
+volatile uint8_t event_overruns = 0;    // bytes dropped, ring was full
+uint8_t state = SM_IDLE;
+uint8_t command = 0, ms_nibble = 0;
+uint16_t block = 0;
+volatile bool handle_disk_data = false;  // set true to request more data for CMD_LIST and CMD_READ, set true to flush data for CMD_WRITE
+uint16_t buff_idx = 0, buff_max = 0, file_size = 0;
+uint8_t request_size = 0;       // bytes of the request received before EODT
+uint8_t final_status = 0x00;    // sent after EODT is ACK'ed, e.g. CRC check result for CMD_READ
+uint16_t list_block = 0;        // block of the last listed file, CMD_LIST records carry delta from it
+uint8_t buff[PAGE_SIZE];
+#if TRACE
+bool trace_reply = false;       // byte is taken, its reply is not traced yet
+#endif
+char buff_aux[MAX_REQUEST_SIZE];
+volatile bool block_mode = false;   // CMD_WRITE_BLOCK data, INT0 puts bytes into buff without the event ring
+volatile uint8_t page_sum = 0;      // sum of the page bytes received in block mode, 0 once the sum byte matches
+uint8_t page_start = 0;             // buff_idx the page starts at, FileEntry_t leads the first one
+bool page_ahead = false;            // last byte of the page is in MCU_OUT, next page is read before CPU ACKs it
+#if PREFETCH
+uint16_t EEMEM boot_block = 0xffff;   // file read first after the last power-up, 0xffff if none
+bool boot_learned = false;          // boot_block is updated once per power-up
+void check_boot_file();
+#endif
 
 // forward declarations
 void init_mcu();
 void reset();
+void handle_event(uint8_t in_byte);
+uint8_t cmd_type(uint8_t cmd);
 void send_data_nibble();
+uint8_t put_uint16(uint8_t *p, uint16_t value);
+uint16_t get_uint16(const uint8_t *p);
+bool parse_request(uint16_t *pblock, uint16_t *args, uint8_t nargs);
 bool handle_cmd_list(bool init);
 bool handle_cmd_read(bool initial);
+bool handle_cmd_read_range();
 bool handle_cmd_write(bool initial);
+bool handle_cmd_update(bool initial);
 bool handle_cmd_delete();
+bool handle_cmd_open();
+bool handle_cmd_read_next();
+bool handle_cmd_seek_close();
+bool handle_cmd_stats();
 #if BULK_TRANSFER
 void bulk_erase();
 void bulk_read();
 void bulk_write();
+void drain_uart();
+#if BULK_RATE
+void set_rate();
+void safe_rate();
+void report_transfer(uint32_t bytes);
+bool rate_raised = false;       // U2X rate negotiated by 'U', dropped after bulk commands and when idle
+uint32_t rate_idle_since = 0;   // Timer_now() of the last UART command
+#else
+#define safe_rate()             /**/
+#define report_transfer(bytes)  /**/
+#endif
 #endif            
+
 #if DEBUG
 void value_to_hex(uint8_t value);
 void print_msg(const char *msg);
@@ -109,10 +219,50 @@ void print_buffer();
 #define print_buffer()              /**/
 #endif
 
+bool begin_list()   { return handle_cmd_list(true); }
+bool begin_read()   { return handle_cmd_read(true); }
+bool begin_write()  { return handle_cmd_write(true); }
+bool begin_update() { return handle_cmd_update(true); }
+
+// Same request as CMD_WRITE, then pages are received by INT0
+bool begin_write_block() {
+    bool ok = handle_cmd_write(true);
+    page_start = buff_idx;
+    page_sum = 0;
+    block_mode = ok;
+    return ok;
+}
+
+// Indexed by command code
+static const command_t commands[] PROGMEM = {
+    [CMD_RESET]         = { NULL,                   CMD_TYPE_NONE,      STATS_OTHER },
+    [CMD_LIST]          = { begin_list,             CMD_TYPE_SEND,      STATS_LIST },
+    [CMD_READ]          = { begin_read,             CMD_TYPE_SEND,      STATS_READ },
+    [CMD_WRITE]         = { begin_write,            CMD_TYPE_RECEIVE,   STATS_WRITE },
+    [CMD_DELETE]        = { handle_cmd_delete,      CMD_TYPE_STATUS,    STATS_DELETE },
+    [CMD_READ_RANGE]    = { handle_cmd_read_range,  CMD_TYPE_SEND,      STATS_OTHER },
+    [CMD_UPDATE]        = { begin_update,           CMD_TYPE_RECEIVE,   STATS_OTHER },
+    [CMD_OPEN]          = { handle_cmd_open,        CMD_TYPE_SEND,      STATS_OTHER },
+    [CMD_READ_NEXT]     = { handle_cmd_read_next,   CMD_TYPE_SEND,      STATS_OTHER },
+    [CMD_SEEK]          = { handle_cmd_seek_close,  CMD_TYPE_STATUS,    STATS_OTHER },
+    [CMD_CLOSE]         = { handle_cmd_seek_close,  CMD_TYPE_STATUS,    STATS_OTHER },
+    [CMD_STATS]         = { handle_cmd_stats,       CMD_TYPE_SEND,      STATS_OTHER },
+    [CMD_WRITE_BLOCK]   = { begin_write_block,      CMD_TYPE_RECEIVE,   STATS_WRITE },
+};
+#define CMD_COUNT   (sizeof(commands) / sizeof(commands[0]))
+
 int main(void) {
     init_mcu();
     if (W25Q64FV_begin(PB4) == W25Q64FV_OK)
         print_msg("FD ");
+#if SNAPSHOT
+    // Scans the directory only if the snapshot does not match flash
+    SimpleFS_mount((uint8_t*)buff);
+#endif
+#if PREFETCH
+    // First CMD_READ of the same file starts streaming without the directory scan
+    SimpleFS_prefetch((uint8_t*)buff, eeprom_read_word(&boot_block));
+#endif
 
     reset();
     MCU_OUT = 0x00; // not busy, not ready
@@ -120,60 +270,77 @@ int main(void) {
         // Check for UART command
         if (uart_available()) {
             uint8_t ch = uart_receive();
+#if BULK_RATE
+            rate_idle_since = Timer_now();
+#endif
             if (ch == 'r') reset();
-            else if (ch == 's') print_status();
+            else if (ch == 's') { print_status(); Stats_dump(); }
+            else if (ch == 't') Trace_dump(CLEWRITE_PULSE_US * (F_CPU / 1000000));
             else if (ch == 'b') print_buffer();
 #if BULK_TRANSFER
-            else if (ch == 'E') bulk_erase();
-            else if (ch == 'R') bulk_read();
-            else if (ch == 'W') bulk_write();
+            else if (ch == 'E') { bulk_erase(); safe_rate(); }
+            else if (ch == 'R') { bulk_read(); safe_rate(); }
+            else if (ch == 'W') { bulk_write(); safe_rate(); }
+#if BULK_RATE
+            else if (ch == 'U') set_rate();
+#endif
 #endif            
+#if FILE_SERVER
+            else if (ch == 'F') {
+#if PREFETCH
+                SimpleFS_prefetchDrop();    // buff and read state are taken
+#endif
+                FileServer_request((uint8_t*)buff);
+#if PREFETCH
+                check_boot_file();
+#endif
+                reset();
+            }
+#endif
+        }
+
+#if BULK_RATE
+        // Host is gone without a bulk command, the next one starts at the safe rate
+        if (rate_raised && Timer_now() - rate_idle_since > RATE_IDLE_CYCLES) {
+            safe_rate();
+        }
+#endif
+
+        // One event at a time, disk work it requests is done before the next one
+        if (event_tail != event_head) {
+            uint8_t in_byte = events[event_tail];
+            event_tail = (event_tail + 1) & EVENT_RING_MASK;
+            TRACE_EVENT(TR_TAKE | state, in_byte);
+#if TRACE
+            trace_reply = true;
+#endif
+            handle_event(in_byte);
         }
 
         switch (state) {
             case SM_IDLE:
                 break;
 
-            case SM_PROCESS_CMD:
+            case SM_PROCESS_CMD: {
                 // New request from CPU, buff contains request data
-                switch (command) {
-                    case CMD_LIST:
-                        if (handle_cmd_list(true)) {
-                            state = SM_SEND_DATA;
-                            MCU_OUT = BODT;
-                        } else {
-                            state = SM_IDLE;
-                            MCU_OUT = EODT;
-                        }
-                        break;
-                    case CMD_READ:
-                        if (handle_cmd_read(true)) {
-                            state = SM_SEND_DATA;
-                            MCU_OUT = BODT;
-                        } else {
-                            state = SM_IDLE;
-                            MCU_OUT = EODT;
-                        }
+                bool (*begin)() = pgm_read_ptr(&commands[command].begin);
+                bool ok = begin();
+                switch (cmd_type(command)) {
+                    case CMD_TYPE_SEND:
+                        state = ok ? SM_SEND_DATA : SM_IDLE;
+                        MCU_OUT = ok ? BODT : EODT;
                         break;
-                    case CMD_WRITE:
-                        if (handle_cmd_write(true)) {
-                            state = SM_RECEIVE_DATA;
-                            MCU_OUT = ACK;
-                        } else {
-                            state = SM_IDLE;
-                            MCU_OUT = NACK;
-                        }
+                    case CMD_TYPE_RECEIVE:
+                        state = ok ? SM_RECEIVE_DATA : SM_IDLE;
+                        MCU_OUT = ok ? ACK : NACK;
                         break;
-                    case CMD_DELETE:
-                        if (handle_cmd_delete()) {
-                            MCU_OUT = ACK;
-                        } else {
-                            MCU_OUT = NACK;
-                        }
+                    default:
                         state = SM_IDLE;
+                        MCU_OUT = ok ? ACK : NACK;
                         break;
                 }
                 break;
+            }
 
             case SM_SEND_DATA:
                 if (command == CMD_LIST && handle_disk_data) {
@@ -184,11 +351,25 @@ int main(void) {
                         state = SM_FINISH;
                         MCU_OUT = EODT;
                     }
-                } else if (command == CMD_READ && handle_disk_data) {
+                } else if (page_ahead) {
+                    // CPU works on the last byte meanwhile, its ACK finds the page ready.
+                    // If the read fails the ACK ends the transfer, NACK is the final status
+                    page_ahead = false;
+                    if (!handle_cmd_read(false)) {
+                        buff_idx = buff_max;
+                        file_size = 0;
+                        final_status = NACK;
+                    }
+                } else if (cmd_type(command) == CMD_TYPE_SEND && handle_disk_data) {
                     handle_disk_data = false;
-                    if (buff_max == PAGE_SIZE && handle_cmd_read(false)) {
+                    if (file_size && handle_cmd_read(false)) {
                         send_data_nibble();
                     } else {
+#if CRC
+                        if (command != CMD_STATS && final_status != NACK) {
+                            final_status = (!file_size && SimpleFS_verifyFile() == OK) ? ACK : NACK;
+                        }
+#endif
                         state = SM_FINISH;
                         MCU_OUT = EODT;
                     }
@@ -206,125 +387,253 @@ int main(void) {
                     } else {
                         MCU_OUT = NACK;
                     }
+                } else if (command == CMD_WRITE_BLOCK && handle_disk_data) {
+                    handle_disk_data = false;
+                    if (page_sum) {
+                        // CPU sends the page again
+                        buff_idx = page_start;
+                        page_sum = 0;
+                        MCU_OUT = NACK;
+                    } else if (handle_cmd_write(false)) {
+                        page_start = 0;
+                        if (buff_max == 0) {
+                            reset();
+                        }
+                        MCU_OUT = ACK;
+                    } else {
+                        reset();
+                        MCU_OUT = NACK;
+                    }
+                } else if (command == CMD_UPDATE && handle_disk_data) {
+                    handle_disk_data = false;
+                    bool finish = state == SM_FINISH;
+                    if (handle_cmd_update(false)) {
+                        if (finish) {
+                            reset();
+                        }
+                        MCU_OUT = ACK;
+                    } else {
+                        reset();
+                        MCU_OUT = NACK;
+                    }
                 }
                 break;
             default:
                 break;
         }
+        if (state == SM_IDLE) {
+            Stats_commandEnd();
+        }
+#if TRACE
+        if (trace_reply && MCU_OUT != BSY_FLAG) {
+            TRACE_EVENT(TR_OUT | state, MCU_OUT);
+            trace_reply = false;
+        }
+#endif
+    }
+}
+
+// Block mode data nibble, returns MCU_OUT for the CPU. ACK_FLAG toggles with every nibble,
+// it is set once a byte is complete, so CPU sees the nibble is taken without the main loop.
+// Sum byte follows the page, BSY is kept until the main loop replies ACK or NACK
+static inline uint8_t block_data(uint8_t in_byte) {
+    if (!ms_nibble) {
+        ms_nibble = in_byte;
+        return 0;
     }
+    uint8_t value = ((ms_nibble & 0x0f) << 4) | (in_byte & 0x0f);
+    ms_nibble = 0;
+    if (buff_idx < buff_max) {
+        buff[buff_idx++] = value;
+        page_sum += value;
+        return ACK_FLAG;
+    }
+    page_sum -= value;
+    handle_disk_data = true;
+    return BSY_FLAG;
 }
 
-// Interrupt Service Routine for INT0
+// Interrupt Service Routine for INT0, the byte is queued and the latch is released at once
 ISR(INT0_vect) {
     // Set BSY_FLAG, clear RDY_FLAG
     MCU_OUT = BSY_FLAG;
+#if STATS
+    uint16_t t = TCNT1;
+#endif
 
     uint8_t in_byte = MCU_IN;
-#if DEBUG
-    value_to_hex(in_byte);
-    uart_transmit_string(buff_aux);
+    TRACE_EVENT(TR_IN | state, in_byte);
+    uint8_t out = BSY_FLAG;     // main loop replies to queued bytes
+    if (block_mode && (in_byte & DAT_FLAG)) {
+        out = block_data(in_byte);
+    } else {
+        uint8_t head = event_head;
+        uint8_t next = (head + 1) & EVENT_RING_MASK;
+        if (next != event_tail) {
+            events[head] = in_byte;
+            event_head = next;
+        } else {
+            event_overruns++;
+        }
+    }
+
+#if TRACE
+    uint16_t d = TCNT1 - t;
+    TRACE_EVENT(TR_RELEASE | state, d < 0xff ? d : 0xff);
 #endif
+    // Strobe CLEWRITE
+    CLR_CLEWRITE();
+    _delay_us(CLEWRITE_PULSE_US);
+    SET_CLEWRITE();
+    MCU_OUT = out;  // after the latch is released, CPU may write once BSY is clear
+    STATS_ISR_END(t);
+}
+
+uint8_t cmd_type(uint8_t cmd) {
+    return cmd < CMD_COUNT ? pgm_read_byte(&commands[cmd].type) : CMD_TYPE_NONE;
+}
+
+uint8_t event_class(uint8_t in_byte) {
     if (in_byte & DAT_FLAG) {
-        if (state == SM_RECEIVE_CMD || state == SM_RECEIVE_DATA) {
-            if (buff_idx < sizeof(buff)) {
-                if (ms_nibble) {
-                    buff[buff_idx ++] = ((ms_nibble & 0x0f) << 4) | (in_byte & 0x0f);
-                    ms_nibble = 0;
-                    if (buff_idx >= sizeof(buff)) {
-                        handle_disk_data = true;
-                    }                  
-                } else {
-                    ms_nibble = in_byte;
-                }
+        return EV_DATA;
+    }
+    // 5th bit not set -> control/status mode
+    switch (in_byte) {
+        case CMD_RESET: return EV_RESET;
+        case BODT:      return EV_BODT;
+        case EODT:      return EV_EODT;
+        case ACK:       return EV_ACK;
+        case NACK:      return EV_NACK;
+        default:
+            return cmd_type(in_byte) != CMD_TYPE_NONE ? EV_COMMAND : EV_OTHER;
+    }
+}
+
+void on_data(uint8_t in_byte) {
+    if (state == SM_RECEIVE_CMD || state == SM_RECEIVE_DATA) {
+        if (buff_idx < sizeof(buff)) {
+            if (ms_nibble) {
+                buff[buff_idx ++] = ((ms_nibble & 0x0f) << 4) | (in_byte & 0x0f);
+                ms_nibble = 0;
+                if (buff_idx >= sizeof(buff)) {
+                    handle_disk_data = true;
+                }                  
             } else {
-                print_msg("MEM!");  // we're out of bounds - very bad
-            }
-            if (!handle_disk_data) {
-                MCU_OUT = ACK;
+                ms_nibble = in_byte;
             }
+        } else {
+            print_msg("MEM!");  // we're out of bounds - very bad
         }
-    } else {
-        // 5th bit not set -> control/status mode
-        switch (in_byte) {
-            case CMD_RESET:
-                reset();
-                MCU_OUT = ACK;
-                break;
-            case CMD_LIST:
-            case CMD_READ:
-            case CMD_WRITE:
-            case CMD_DELETE:
-                command = in_byte;
-                state = SM_RECEIVE_CMD;
-                buff_max = MAX_NAME_SIZE;  // max number of bytes to transfer
-                buff_idx = 0;   // from 0
-                ms_nibble = 0;  // no last nibble
-                handle_disk_data = false;
-                MCU_OUT = ACK;
-                break;
-            case BODT:
-                MCU_OUT = ACK;
-                break;
-            case EODT:
-                if (state == SM_RECEIVE_CMD) {
-                    // here have we received command, start processing..
-                    buff[buff_idx] = '\0';
-                    state = SM_PROCESS_CMD;
-                } else if (command == CMD_WRITE && state == SM_RECEIVE_DATA) {
-                    // finish writing rest of data to disk
-                    state = SM_FINISH;
-                    MCU_OUT = ACK;
-                    handle_disk_data = true;
-                }
-                break;
-            case ACK:
-                switch (command) {
-                    case CMD_LIST:
-                    case CMD_READ:
-                        if (state == SM_SEND_DATA) {
-                            if (buff_idx < buff_max) {
-                                send_data_nibble();
-                            } else {            // end of buffer
-                                handle_disk_data = true;
-                            }
-                        }
-                        break;
-                    case CMD_WRITE:
-                    case CMD_DELETE:
-                        break;
-                    default:
-                        print_msg("ACK?");
-                        break;
-                }
+        if (!handle_disk_data) {
+            MCU_OUT = ACK;
+        }
+    }
+}
 
-                if (state == SM_FINISH) {
-                    print_msg("FIN");
-                    reset();
-                    MCU_OUT = 0x00;     // not busy, not ready
-                }
-                CLR_BSY_FLAG();
-                break;
-            case NACK:
-                print_msg("NACK");
-                reset();
-                MCU_OUT = 0x00; // not busy, not ready
-                break;
-            default:
-                // Some other status or control byte
-                break;
+void on_reset(uint8_t in_byte) {
+    reset();
+    MCU_OUT = ACK;
+}
+
+void on_command(uint8_t in_byte) {
+    Stats_commandBegin(pgm_read_byte(&commands[in_byte].stats));
+    IoStat_begin(IO_OTHER);
+#if PREFETCH
+    if (in_byte != CMD_READ) {
+        SimpleFS_prefetchDrop();
+    }
+#endif
+    command = in_byte;
+    block_mode = false;     // request nibbles go through the event ring
+    page_ahead = false;     // transfer in progress is cancelled
+    state = SM_RECEIVE_CMD;
+    buff_max = MAX_REQUEST_SIZE;  // max number of bytes to transfer
+    buff_idx = 0;   // from 0
+    ms_nibble = 0;  // no last nibble
+    handle_disk_data = false;
+    MCU_OUT = ACK;
+}
+
+void on_bodt(uint8_t in_byte) {
+    MCU_OUT = ACK;
+}
+
+void on_eodt(uint8_t in_byte) {
+    if (state == SM_RECEIVE_CMD) {
+        // here have we received command, start processing..
+        // BSY set by INT0 is kept until the reply, CPU polls for it
+        request_size = buff_idx;
+        state = SM_PROCESS_CMD;
+    } else if (command == CMD_WRITE && state == SM_RECEIVE_DATA) {
+        // finish writing rest of data to disk
+        state = SM_FINISH;
+        MCU_OUT = ACK;
+        handle_disk_data = true;
+    } else if (command == CMD_UPDATE && state == SM_RECEIVE_DATA) {
+        // ACK is sent once the update is complete, MCU stays busy meanwhile
+        state = SM_FINISH;
+        handle_disk_data = true;
+    }
+}
+
+void on_ack(uint8_t in_byte) {
+    if (cmd_type(command) == CMD_TYPE_SEND) {
+        if (state == SM_SEND_DATA) {
+            if (buff_idx < buff_max) {
+                send_data_nibble();
+                // buff is free once its last byte is latched, CMD_LIST builds records on demand
+                page_ahead = buff_idx == buff_max && file_size && command != CMD_LIST;
+            } else {            // end of buffer
+                handle_disk_data = true;
+            }
         }
+    } else if (command == 0) {
+        print_msg("ACK?");
     }
 
-    // Strobe CLEWRITE for 1 ms
-    CLR_CLEWRITE();
-    _delay_ms(1);
-    SET_CLEWRITE();
+    if (state == SM_FINISH) {
+        print_msg("FIN");
+        uint8_t status = final_status;
+        reset();
+        MCU_OUT = status;   // 0x00 - not busy, not ready, or a final status
+    }
+    CLR_BSY_FLAG();
+}
+
+void on_nack(uint8_t in_byte) {
+    print_msg("NACK");
+    reset();
+    MCU_OUT = 0x00; // not busy, not ready
+}
+
+void on_other(uint8_t in_byte) {
+}
+
+// Indexed by mcu_event_t
+static void (* const event_handlers[])(uint8_t) PROGMEM = {
+    [EV_DATA]       = on_data,
+    [EV_RESET]      = on_reset,
+    [EV_COMMAND]    = on_command,
+    [EV_BODT]       = on_bodt,
+    [EV_EODT]       = on_eodt,
+    [EV_ACK]        = on_ack,
+    [EV_NACK]       = on_nack,
+    [EV_OTHER]      = on_other,
+};
+
+void handle_event(uint8_t in_byte) {
+#if DEBUG
+    value_to_hex(in_byte);
+    uart_transmit_string(buff_aux);
+#endif
+    void (*handler)(uint8_t) = pgm_read_ptr(&event_handlers[event_class(in_byte)]);
+    handler(in_byte);
 }
 
 
 void init_mcu() {
     // Initialize UART with calculated UBRR
-    uart_init(F_CPU / 16 / BAUD - 1);
+    uart_init(SAFE_UBRR);
 #if DEBUG
     // Send a string over UART
     print_msg("RC6502 ");
@@ -345,6 +654,9 @@ void init_mcu() {
     // Enable external interrupt INT0
     GICR |= (1 << INT0);
 
+    // Timer1 counts cycles, used by flash waits and statistics
+    Timer_init();
+
     // Enable global interrupts
     sei();
 }
@@ -359,6 +671,10 @@ void reset() {
     buff_idx = 0;
     handle_disk_data = false;
     file_size = 0;
+    final_status = 0x00;
+    list_block = 0;
+    block_mode = false;
+    page_ahead = false;
 }
 
 void send_data_nibble() {
@@ -372,27 +688,84 @@ void send_data_nibble() {
     }
 }
 
+uint8_t put_uint16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+    return 2;
+}
+
+uint16_t get_uint16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+// Requests are binary, numbers are little endian. A file is addressed by name length and name,
+// or by 0 and 16-bit block, handle commands send the handle the same way. nargs 16-bit numbers follow.
+// The name is copied to buff_aux and terminated, it is empty if the file is addressed by block
+bool parse_request(uint16_t *pblock, uint16_t *args, uint8_t nargs) {
+    uint8_t len = buff[0];
+    uint8_t n = 1 + (len ? len : 2);
+    if (len >= MAX_NAME_SIZE || request_size != n + 2 * nargs) {
+        return false;
+    }
+    memcpy(buff_aux, (const char*)buff + 1, len);
+    buff_aux[len] = '\0';
+    *pblock = len ? 0 : get_uint16(buff + 1);
+    for (uint8_t i = 0; i < nargs; i++, n += 2) {
+        args[i] = get_uint16(buff + n);
+    }
+    return true;
+}
+
 bool handle_cmd_list(bool initial) {
 #if LIST
-    buff_max = sizeof(FileEntry_t);  // number of bytes to transfer
+    buff_max = 0;   // number of bytes to transfer
     buff_idx = 0;   // reset index
     ms_nibble = 0;  // no last nibble
-    // SimpleFS_listFiles will use 32 bytes of the buff, so we can reuse other space in th buffer
-    char* prefix = (char*)buff + 100;
     if (initial) {
-        memcpy(prefix, (const char*)buff, MAX_NAME_SIZE);
+        // Pattern is sent like a name, it may be longer
+        uint8_t len = buff[0] < MAX_REQUEST_SIZE ? buff[0] : MAX_REQUEST_SIZE - 1;
+        memcpy(LIST_PATTERN, (const char*)buff + 1, len);
+        LIST_PATTERN[len] = '\0';
         block = 0;
-        print_msg_string("L!", prefix);
-    } else {
-        block ++;
+        list_block = 0;
+        print_msg_string("L!", LIST_PATTERN);
     }
 
-    uint8_t status = SimpleFS_listFiles((uint8_t*)buff, (uint16_t*)&block, prefix);
-    if (status != OK && status != FILE_ENTRY_IS_NOT_FOUND) {
-        buff_max = 0;
-        print_msg_hex("err:", status);
+    // Entries are scanned into buff_aux, records are packed into buff
+    FileEntry_t *fe = (FileEntry_t *)buff_aux;
+    while (buff_max + LIST_RECORD_MAX <= LIST_BATCH_SIZE) {
+        uint8_t status = SimpleFS_listFiles((uint8_t*)buff_aux, (uint16_t*)&block, LIST_PATTERN);
+        if (status != OK) {
+            if (status != FILE_ENTRY_IS_NOT_FOUND) {
+                print_msg_hex("err:", status);
+            }
+            block = 0xffff; // nothing left to scan
+            break;
+        }
+
+        uint8_t *rec = (uint8_t*)buff + buff_max;
+        uint8_t len = strnlen(fe->name, MAX_NAME_SIZE - 1);
+        uint8_t n = 1;
+        rec[0] = len;
+        if (block - list_block < 0x100) {
+            rec[n++] = block - list_block;
+        } else {
+            rec[0] |= LIST_BLOCK16;
+            n += put_uint16(rec + n, block);
+        }
+        n += put_uint16(rec + n, fe->start);
+        if (fe->flags & FE_FLAG_LZ) {
+            rec[0] |= LIST_LZ;
+            n += put_uint16(rec + n, fe->xsize);
+        }
+        n += put_uint16(rec + n, fe->size);
+        memcpy(rec + n, fe->name, len);
+        buff_max += n + len;
+
+        list_block = block;
+        block = SimpleFS_nextBlock((uint8_t*)buff_aux, block);
     }
-    return status == OK; // true if buffer contains a valid file entry
+    return buff_max > 0; // true if buffer contains at least one record
 #else
     return false;
 #endif
@@ -405,13 +778,27 @@ bool handle_cmd_read(bool initial) {
     ms_nibble = 0;  // no last nibble
     uint8_t status;
     if (initial) {
-        print_msg_string("R!", (const char *)buff);
-        if (*buff == '#') {
-            status = SimpleFS_readFileByBlockNo((uint8_t*)buff, (uint8_t)atoi((const char*)buff+1), (uint16_t*)&file_size);
-        } else {
-            memcpy(buff_aux, (const char*)buff, sizeof(buff_aux));
+        uint16_t block;
+        if (!parse_request(&block, NULL, 0)) {
+            status = INVALID_DATA;
+#if PREFETCH
+        } else if (SimpleFS_readPrefetched((uint8_t*)buff, buff_aux, block, (uint16_t*)&file_size) == OK) {
+            print_msg("R+");
+            status = OK;
+#endif
+        } else if (*buff_aux) {
+            print_msg_string("R!", buff_aux);
             status = SimpleFS_readFileByName((uint8_t*)buff, buff_aux, (uint16_t*)&file_size);
+        } else {
+            print_msg_hex("R#", block);
+            status = SimpleFS_readFileByBlockNo((uint8_t*)buff, block, (uint16_t*)&file_size);
+        }
+#if PREFETCH
+        if (status == OK && !boot_learned) {
+            boot_learned = true;
+            eeprom_update_word(&boot_block, ((FileEntry_t *)buff)->block);
         }
+#endif
     } else {
         status = SimpleFS_readFileNextPage((uint8_t*)buff);
     }
@@ -427,14 +814,51 @@ bool handle_cmd_read(bool initial) {
 #endif
 }
 
+#if PREFETCH
+// boot_block is cleared once its file is deleted or moved, buff gets the entry
+void check_boot_file() {
+    uint16_t block = eeprom_read_word(&boot_block);
+    if (block != 0xffff && SimpleFS_statFile((uint8_t*)buff, "", block) != OK) {
+        eeprom_update_word(&boot_block, 0xffff);
+    }
+}
+#endif
+
+// Pages follow from the offset, handle_cmd_read streams the rest
+bool handle_cmd_read_range() {
+#if READ
+    buff_idx = 0;   // reset index
+    ms_nibble = 0;  // no last nibble
+    uint16_t block, args[2];    // offset, length
+    uint8_t status = INVALID_DATA;
+    if (parse_request(&block, args, 2)) {
+        print_msg_string("RR!", buff_aux);
+        status = SimpleFS_readFileRange((uint8_t*)buff, buff_aux, block, args[0], args[1], (uint16_t*)&file_size);
+    }
+    if (status == OK) {
+        buff_max = file_size < PAGE_SIZE ? file_size : PAGE_SIZE;
+        file_size -= buff_max;
+    } else {
+        buff_max = 0;
+        print_msg_hex("err:", status);
+    }
+    return status == OK; // true if buffer contains a valid data
+#else
+    return false;
+#endif
+}
+
 bool handle_cmd_write(bool initial) {
 #if WRITE
     uint8_t status;
     if (initial) {          // create a file structure first
-        print_msg_string("W!", (const char *)buff);
-        memcpy(buff_aux, (const char*)buff, sizeof(buff_aux));
-        uint16_t block = 0;  // A new entry will be allocated starting from this block
-        status = SimpleFS_createFileEntry((uint8_t*)buff, buff_aux, &block, (uint16_t*)&file_size);
+        uint16_t block, args[2];    // start, size
+        status = INVALID_DATA;
+        if (parse_request(&block, args, 2)) {
+            print_msg_string("W!", buff_aux);
+            block = 0;  // A new entry will be allocated starting from this block
+            status = SimpleFS_createFileEntry((uint8_t*)buff, buff_aux, args[0], args[1], &block, (uint16_t*)&file_size);
+        }
         buff_max = file_size < PAGE_SIZE ? file_size : PAGE_SIZE;
         buff_idx = sizeof(FileEntry_t);
         ms_nibble = 0;  // no last nibble
@@ -458,25 +882,161 @@ bool handle_cmd_write(bool initial) {
 #endif
 }
 
+// Data is received into buff at the position it takes within the flash page,
+// so a page is flushed once buff is full, the last one on EODT
+bool handle_cmd_update(bool initial) {
+#if UPDATE
+    uint8_t status;
+    if (initial) {
+        uint16_t block, args[2], idx = 0;  // offset, length
+        status = INVALID_DATA;
+        if (parse_request(&block, args, 2)) {
+            print_msg_string("U!", buff_aux);
+            status = SimpleFS_updateBegin((uint8_t*)buff, buff_aux, block, args[0], args[1], (uint16_t*)&file_size, &idx);
+        }
+        buff_max = idx; // data of the page starts here
+        buff_idx = idx;
+        ms_nibble = 0;  // no last nibble
+    } else {
+        uint16_t size = buff_idx - buff_max;
+        if (size > file_size) {
+            size = file_size;   // ignore data beyond the range
+        }
+        status = SimpleFS_updateWrite((uint8_t*)buff, size);
+        file_size -= size;
+        buff_max = 0;
+        buff_idx = 0;
+        if (status == OK && state == SM_FINISH) {
+            status = SimpleFS_updateFinish();
+#if PREFETCH
+            check_boot_file();  // a copy replaces the file
+#endif
+        }
+    }
+    if (status != OK) {
+        print_msg_hex("err:", status);
+    }
+    return status == OK; // true if data is written and more could follow
+#else
+    return false;
+#endif
+}
+
 bool handle_cmd_delete() {
 #if DELETE
     uint8_t status;
-    print_msg_string("D!", (const char *)buff);
-    if (*buff == '#') {
-        status = SimpleFS_deleteFileByBlockNo((uint8_t*)buff, (uint8_t)atoi((const char*)buff+1));
-    } else {
-        memcpy(buff_aux, (const char*)buff, sizeof(buff_aux));
+    uint16_t block;
+    if (!parse_request(&block, NULL, 0)) {
+        status = INVALID_DATA;
+    } else if (*buff_aux) {
+        print_msg_string("D!", buff_aux);
         status = SimpleFS_deleteFileByName((uint8_t*)buff, buff_aux);
+    } else {
+        print_msg_hex("D#", block);
+        status = SimpleFS_deleteFileByBlockNo((uint8_t*)buff, block);
     }
     if (status != OK && status != FILE_ENTRY_IS_NOT_FOUND) {
         print_msg_hex("err:", status);
     }
+#if PREFETCH
+    if (status == OK) {
+        check_boot_file();
+    }
+#endif
     return status == OK; // true if buffer contains a valid data
 #else
     return false;
 #endif
 }
 
+// Replies with handle number, start address and size of the file
+bool handle_cmd_open() {
+#if HANDLES
+    buff_idx = 0;   // reset index
+    ms_nibble = 0;  // no last nibble
+    file_size = 0;  // nothing follows the reply
+    uint16_t block;
+    uint8_t handle;
+    uint8_t status = INVALID_DATA;
+    if (parse_request(&block, NULL, 0)) {
+        print_msg_string("O!", buff_aux);
+        status = SimpleFS_openFile((uint8_t*)buff, buff_aux, block, &handle);
+    }
+    if (status == OK) {
+        FileEntry_t *fe = (FileEntry_t *)buff;
+        uint16_t start = fe->start, size = fe->size;
+        buff[0] = handle;
+        put_uint16((uint8_t*)buff + 1, start);
+        put_uint16((uint8_t*)buff + 3, size);
+        buff_max = 5;
+    } else {
+        buff_max = 0;
+        print_msg_hex("err:", status);
+    }
+    return status == OK;
+#else
+    return false;
+#endif
+}
+
+// Streams from the handle position like CMD_READ_RANGE, handle_cmd_read streams the rest
+bool handle_cmd_read_next() {
+#if HANDLES
+    buff_idx = 0;   // reset index
+    ms_nibble = 0;  // no last nibble
+    uint16_t handle, length;
+    uint8_t status = INVALID_DATA;
+    if (parse_request(&handle, &length, 1)) {
+        print_msg_hex("N#", handle);
+        status = SimpleFS_readHandle((uint8_t*)buff, handle, length, (uint16_t*)&file_size);
+    }
+    if (status == OK) {
+        buff_max = file_size < PAGE_SIZE ? file_size : PAGE_SIZE;
+        file_size -= buff_max;
+    } else {
+        buff_max = 0;
+        print_msg_hex("err:", status);
+    }
+    return status == OK;
+#else
+    return false;
+#endif
+}
+
+bool handle_cmd_seek_close() {
+#if HANDLES
+    uint16_t handle, offset;
+    uint8_t status = INVALID_DATA;
+    if (command == CMD_SEEK && parse_request(&handle, &offset, 1)) {
+        print_msg_hex("S#", handle);
+        status = SimpleFS_seekHandle(handle, offset);
+    } else if (command == CMD_CLOSE && parse_request(&handle, NULL, 0)) {
+        print_msg_hex("C#", handle);
+        status = SimpleFS_closeHandle(handle);
+    }
+    if (status != OK) {
+        print_msg_hex("err:", status);
+    }
+    return status == OK;
+#else
+    return false;
+#endif
+}
+
+// Replies with counters, see Stats_t
+bool handle_cmd_stats() {
+#if STATS
+    buff_idx = 0;   // reset index
+    ms_nibble = 0;  // no last nibble
+    file_size = 0;  // nothing follows the reply
+    final_status = ACK;
+    buff_max = Stats_record((uint8_t*)buff);
+    return true;
+#else
+    return false;
+#endif
+}
+
 #if DEBUG
 void value_to_hex(uint8_t value) {
     buff_aux[0] = '0';
@@ -506,6 +1066,7 @@ void print_status() {
     print_msg_hex(",idx:", buff_idx);
     print_msg_hex(",max:", buff_max);
     print_msg_hex(",fs:", file_size);
+    print_msg_hex(",ovr:", event_overruns);
 }
 void print_buffer() {
     for (int i = 0; i < buff_max; i++) {
@@ -517,6 +1078,14 @@ void print_buffer() {
 
 #if BULK_TRANSFER
 #include "w25q64fv.h"
+#if BULK_RATE
+static uint32_t uart_ticks;     // Timer ticks spent moving bulk data over UART
+#define UART_TIME_BEGIN()   uint32_t t_ = Timer_now()
+#define UART_TIME_END()     (uart_ticks += (Timer_now() - t_) / TIMER_TICK_CYCLES)
+#else
+#define UART_TIME_BEGIN()   /**/
+#define UART_TIME_END()     /**/
+#endif
 // two bytes are expected- number of pages in binary, little endian. 
 uint16_t receive_uint16() {
     while (!uart_available());
@@ -526,14 +1095,27 @@ uint16_t receive_uint16() {
     return (msb << 8) | lsb;
 }
 
+// three bytes, little endian- page numbers and counts, 65536 pages of a 25Q256 don't fit two
+uint32_t receive_uint24() {
+    uint16_t lsw = receive_uint16();
+    while (!uart_available());
+    return ((uint32_t)uart_receive() << 16) | lsw;
+}
+
 // one parameter is expected.
 // size - number of 32k blocks to erase. if 0 is given, all chip is erased
 void bulk_erase() {
+#if SNAPSHOT
+    Snapshot_invalidate();  // flash is changed behind SimpleFS
+#endif
+#if PREFETCH
+    SimpleFS_prefetchDrop();
+#endif
     uint16_t size = receive_uint16();
     if (size) {
         W25Q64FV_status_t status = W25Q64FV_OK;
-        for (int i = 0; i < size && status == W25Q64FV_OK; i++) {
-            uint32_t address = ((uint32_t)i) * PAGE_SIZE;
+        for (uint16_t i = 0; i < size && status == W25Q64FV_OK; i++) {
+            uint32_t address = ((uint32_t)i) * BLOCK_SIZE;
             status = W25Q64FV_erase_block_32(address, true);
         }
         uart_transmit(status == W25Q64FV_OK ? ACK : NACK);
@@ -541,56 +1123,156 @@ void bulk_erase() {
         W25Q64FV_status_t status = W25Q64FV_erase_chip(true);
         uart_transmit(status == W25Q64FV_OK ? ACK : NACK);
     }
+#if SNAPSHOT
+    SimpleFS_mount((uint8_t*)buff);
+#endif
+#if PREFETCH
+    check_boot_file();
+#endif
 }
 
 // one parameter is expected.
-// size - in terms of page size. if 0 is given, all size 32768 is assumed
+// size - in terms of page size, 3 bytes. if 0 is given, the whole chip is read.
+// Number of pages which follow is sent first, 3 bytes
 void bulk_read() {
-    uint16_t size = receive_uint16();
+#if PREFETCH
+    SimpleFS_prefetchDrop();    // pages are read into buff
+#endif
+    uint32_t size = receive_uint24();
     if (!size) {
-        size = 32768;
+        size = FLASH_SIZE / PAGE_SIZE;
     }
-    for (int i = 0; i < size; i++) {
+    uart_transmit(size);
+    uart_transmit(size >> 8);
+    uart_transmit(size >> 16);
+    for (uint32_t i = 0; i < size; i++) {
         uint32_t address = ((uint32_t)i) * PAGE_SIZE;
         W25Q64FV_status_t status = W25Q64FV_read_page(address, (byte*)buff, PAGE_SIZE);
         if (status == W25Q64FV_OK) {
+            // The last bytes are sent from TX ring while the next page is read
+            UART_TIME_BEGIN();
             for (int j = 0; j < PAGE_SIZE; j++) {
                 uart_transmit(buff[j]);
             }
-            _delay_ms(1000);            
+            UART_TIME_END();
         } else {
             return; // Something went wrong, abort 
         }
     }
+    report_transfer(size * PAGE_SIZE);
 }
 
-// two parameters are expected.
+// two parameters are expected, 3 bytes each.
 // offset - number of pages to skip.
-// size - number of pages to write. if 0 is given, all size 32768 is assumed
+// size - number of pages to write. if 0 is given, the whole chip is assumed
+// A page is ACK'ed once it is sent to flash, so the next one is received while it programs.
+// Program result is checked before the next page is sent to flash, NACK in place of its ACK
+// means the previous page failed. The last page is ACK'ed after it is programmed
 void bulk_write() {
-    uint16_t offs = receive_uint16();
-    uint16_t size = receive_uint16();
+#if SNAPSHOT
+    Snapshot_invalidate();  // flash is changed behind SimpleFS
+#endif
+#if PREFETCH
+    SimpleFS_prefetchDrop();
+#endif
+    uint32_t offs = receive_uint24();
+    uint32_t size = receive_uint24();
     if (!size) {
-        size = 32768;
+        size = FLASH_SIZE / PAGE_SIZE;
     }
-    for (int i = 0; i < size; i++) {
+    for (uint32_t i = 0; i < size; i++) {
+        UART_TIME_BEGIN();
         for (int j = 0; j < PAGE_SIZE; j++) {
             while (!uart_available());
             buff[j] = uart_receive();
         }
+        UART_TIME_END();
 
-        uint32_t address = ((uint32_t)(offs + i)) * PAGE_SIZE;
-        W25Q64FV_enable_writing();
-        W25Q64FV_write_page(address, (byte*)buff);
+        uint32_t address = (offs + i) * PAGE_SIZE;
         W25Q64FV_status_t status = W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
         if (status == W25Q64FV_OK) {
-            _delay_ms(1000);
+            status = W25Q64FV_write_page(address, (byte*)buff);
+            if (status == W25Q64FV_OK && i == size - 1) {
+                status = W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+            }
+        }
+        if (status == W25Q64FV_OK) {
             uart_transmit(ACK);
         } else {
             uart_transmit(NACK);
+            drain_uart();   // rest of the stream must not be taken for commands
             return; // Something went wrong, abort 
         }
     }
+    report_transfer(size * PAGE_SIZE);
+#if SNAPSHOT
+    SimpleFS_mount((uint8_t*)buff);
+#endif
+#if PREFETCH
+    check_boot_file();
+#endif
 }
+
+// Discards input until the host stays silent for 10ms
+void drain_uart() {
+    for (uint8_t quiet = 0; quiet < 100; quiet++) {
+        _delay_us(100);
+        if (uart_available()) {
+            uart_receive();
+            quiet = 0;
+        }
+    }
+}
+
+#if BULK_RATE
+// -1 if nothing arrives within RATE_TIMEOUT_MS
+int16_t receive_timeout() {
+    for (uint16_t i = 0; i < RATE_TIMEOUT_MS * 10; i++) {
+        if (uart_available()) {
+            return uart_receive();
+        }
+        _delay_us(100);
+    }
+    return -1;
+}
+
+void safe_rate() {
+    if (rate_raised) {
+        uart_set_rate(SAFE_UBRR, false);
+        rate_raised = false;
+    }
+}
+
+// one parameter is expected.
+// ubrr - UBRR value for double speed mode, F_CPU / 8 / baud - 1.
+// ACK is sent at the old rate, RATE_PROBE_SIZE bytes are echoed at the new one, then host
+// confirms with ACK which is echoed too. Anything else falls back to the safe rate
+void set_rate() {
+    uint8_t ubrr = uart_receive_blocking();
+    uart_transmit(ACK);
+    uart_set_rate(ubrr, true);
+    rate_raised = true;
+    for (uint8_t i = 0; i <= RATE_PROBE_SIZE; i++) {
+        int16_t value = receive_timeout();
+        if (value < 0 || (i == RATE_PROBE_SIZE && value != ACK)) {
+            safe_rate();
+            break;
+        }
+        uart_transmit(value);
+    }
+    rate_idle_since = Timer_now();
+}
+
+// Time is what UART took to move the data, flash and page delays are not counted
+void report_transfer(uint32_t bytes) {
+    char s[11];
+    uart_transmit_string_P(PSTR("bulk bytes="));
+    uart_transmit_string(ultoa(bytes, s, 10));
+    uart_transmit_string_P(PSTR(" us="));
+    uart_transmit_string(ultoa(uart_ticks * (TIMER_TICK_CYCLES / (F_CPU / 1000000)), s, 10));
+    uart_transmit_string_P(PSTR("\r\n"));
+    uart_ticks = 0;
+}
+#endif
 #endif            
 
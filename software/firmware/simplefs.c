@@ -6,8 +6,11 @@ Copyright (c) 2025 Arvid Juskaitis
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include "simplefs.h"
+#include "crc32.h"
+#include "snapshot.h"
 
 /*'
  *  Helper functions/ predicates
@@ -26,75 +29,272 @@ int strncasecmp(const char *s1, const char *s2, size_t n) {
     return 0;
 }
 
-#if WRITE
-bool availableEntry(FileEntry_t *fe, void *context) { return fe->block == 0xffff; }
-#endif
+// Entry holds a file which is neither replaced nor being written by an update
+bool is_live(FileEntry_t *fe) {
+  return fe->block != 0xffff && (fe->flags & (FE_FLAGS_VALID | FE_FLAG_PENDING)) == FE_FLAGS_VALID;
+}
 
 #if LIST
-bool nameBeginsWith(FileEntry_t *fe, void *context) {
-  const char *prefix = (const char *)context;
-  return fe->block != 0xffff && (!prefix || strncasecmp(fe->name, prefix, strlen(prefix)) == 0);
+// '*' matches any run of chars, '?' any single char. Pattern only has to match the beginning
+// of the name, so "GAMES/" lists a directory and "*.BAS" lists names containing ".BAS"
+bool nameMatches(FileEntry_t *fe, void *context) {
+  const char *pattern = (const char *)context;
+  const char *name = fe->name, *star = NULL, *resume = NULL;
+  if (!is_live(fe)) {
+    return false;
+  }
+  while (pattern && *pattern) {
+    if (*pattern == '*') {
+      star = ++pattern;
+      resume = name;
+    } else if (*name && (*pattern == '?' || toupper((unsigned char)*pattern) == toupper((unsigned char)*name))) {
+      name++;
+      pattern++;
+    } else if (star && *resume) {
+      pattern = star;
+      name = ++resume;
+    } else {
+      return false;
+    }
+  }
+  return true;
 }
 #endif
 
-#if READ || DELETE
+#if READ || DELETE || UPDATE
 bool nameExactMatch(FileEntry_t *fe, void *context) {
   const char *name = (const char *)context;
-  return fe->block != 0xffff && strncasecmp(fe->name, name, strlen(fe->name)) == 0;
+  return is_live(fe) && strncasecmp(fe->name, name, MAX_NAME_SIZE - 1) == 0;
+}
+#endif
+
+// Names are stored in upper case, hash is case-insensitive for lookups
+uint8_t SimpleFS_nameHash(const char *name) {
+  uint8_t hash = 0;
+  for (uint8_t i = 0; i < MAX_NAME_SIZE - 1 && name[i]; i++) {
+    hash = ((hash << 1) | (hash >> 7)) ^ toupper((unsigned char)name[i]);
+  }
+  return hash;
+}
+
+// Size class of a file: it occupies 1 << class sectors, 8 sectors make a whole block
+uint8_t SimpleFS_sizeClass(uint16_t size) {
+  uint32_t total = sizeof(FileEntry_t) + (uint32_t)size;
+  uint8_t cls = 0;
+  while ((1 << cls) < SECTORS_PER_BLOCK && total > (SECTOR_SIZE << cls)) {
+    cls++;
+  }
+  return cls;
+}
+
+#if STATS
+static uint32_t entries_scanned;    // directory entries probed by find_entry
+
+uint32_t SimpleFS_entriesScanned() {
+  return entries_scanned;
 }
 #endif
 
 #if  LIST || READ || WRITE || DELETE
-uint8_t find_entry(uint8_t *buff, uint16_t *pblock, bool (*predicate)(FileEntry_t *, void *), void *context) {
-  for (uint16_t block = *pblock; block < MAX_BLOCKS; block++) {
-      uint8_t status = W25Q64FV_read_page(block * BLOCK_SIZE, buff, sizeof(FileEntry_t));
+// Files are aligned to their size class, so entries are found by stepping over whole files.
+// Only FE_PROBE_SIZE bytes are read per entry, the whole entry is fetched if hash matches (any, if hash < 0)
+uint8_t find_entry(uint8_t *buff, uint16_t *pblock, int16_t hash, bool (*predicate)(FileEntry_t *, void *), void *context) {
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint16_t max_sectors = MAX_SECTORS;
+  for (uint16_t block = *pblock; block < max_sectors; ) {
+#if SNAPSHOT
+    // 32K blocks without files are skipped unread
+    if (block % SECTORS_PER_BLOCK == 0 && !Snapshot_used(block / SECTORS_PER_BLOCK)) {
+      block += SECTORS_PER_BLOCK;
+      continue;
+    }
+#endif
+    uint8_t status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, FE_PROBE_SIZE);
     if (status != W25Q64FV_OK) {
       return status;
     }
-    if (predicate((FileEntry_t *)buff, context)) {
-      *pblock = block;
-      return OK;
+#if STATS
+    entries_scanned++;
+#endif
+    if (fe->block == 0xffff) {
+      block++;
+      continue;
     }
+    if (hash < 0 || fe->hash == hash) {
+      status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, sizeof(FileEntry_t));
+      if (status != W25Q64FV_OK) {
+        return status;
+      }
+      if (predicate(fe, context)) {
+        *pblock = block;
+        return OK;
+      }
+    }
+    block += FE_SECTORS(fe);
   }
   return FILE_ENTRY_IS_NOT_FOUND;
 }
 #endif
 
-// Function to parse the input string
-#if WRITE
-bool parseWriteFileInput(const char *input, char *name, uint16_t *pstart, uint16_t *pstop) {
-    // Initialize outputs
-    *pstart = *pstop = 0x0000;
+#if READ || UPDATE
+// File is addressed by name, or by *pblock if the name is empty, buff gets the file entry
+uint8_t find_file(uint8_t *buff, const char *name, uint16_t *pblock) {
+  if (*name) {
+    *pblock = 0;
+    return find_entry(buff, pblock, SimpleFS_nameHash(name), nameExactMatch, (void *)name);
+  }
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint8_t status = W25Q64FV_read_page(*pblock * SECTOR_SIZE, buff, sizeof(FileEntry_t));
+  if (status == W25Q64FV_OK && (fe->block != *pblock || !is_live(fe))) {
+    status = BLOCK_IS_NOT_VALID;
+  }
+  return status;
+}
+#endif
+
+#if SNAPSHOT
+// Sectors of a new file are taken, the cursor moves past them if they were the first free ones
+void snapshot_taken(uint16_t block, uint8_t sectors) {
+  uint16_t cursor = Snapshot_cursor();
+  Snapshot_commit(block / SECTORS_PER_BLOCK, true, block == cursor ? block + sectors : cursor);
+}
+
+// The 32K block of an erased file is free unless other files are left in it, the cursor moves back
+void snapshot_erased(uint16_t block) {
+  uint8_t probe[FE_PROBE_SIZE];
+  FileEntry_t *fe = (FileEntry_t *)probe;
+  uint16_t first = block & ~(SECTORS_PER_BLOCK - 1);
+  bool used = false;
+  for (uint16_t b = first; b < first + SECTORS_PER_BLOCK && !used; b++) {
+    used = W25Q64FV_read_page(b * SECTOR_SIZE, probe, FE_PROBE_SIZE) != W25Q64FV_OK || fe->block != 0xffff;
+  }
+  uint16_t cursor = Snapshot_cursor();
+  Snapshot_commit(first / SECTORS_PER_BLOCK, used, block < cursor ? block : cursor);
+}
+#endif
 
-    // Locate the first colon
-    const char *hash = strchr(input, '#');
-    if (!hash) {
-        return false; // Invalid format, no colon found
+#if DELETE
+uint8_t erase_file(uint16_t block, FileEntry_t *fe) {
+  uint8_t sectors = FE_SECTORS(fe);
+  uint8_t status = W25Q64FV_OK;
+  if (sectors == SECTORS_PER_BLOCK) {
+    status = W25Q64FV_erase_block_32(block * SECTOR_SIZE, true);
+  } else {
+    for (uint8_t i = 0; i < sectors && status == W25Q64FV_OK; i++) {
+      status = W25Q64FV_erase_sector_4k((block + i) * SECTOR_SIZE, true);
     }
+  }
+#if SNAPSHOT
+  if (status == W25Q64FV_OK) {
+    snapshot_erased(block);
+  }
+#endif
+  return status;
+}
+#endif
 
-    // Copy and pad the name
-    size_t name_len = hash - input;
-    if (name_len >= MAX_NAME_SIZE) {
-        name_len = MAX_NAME_SIZE - 1; // Truncate if too long
+#if WRITE
+// Find the first run of erased sectors, aligned to its length
+uint8_t find_free_from(uint8_t *buff, uint16_t *pblock, uint8_t sectors) {
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint8_t run = 0;
+  uint16_t max_sectors = MAX_SECTORS;
+  for (uint16_t block = *pblock; block < max_sectors; ) {
+#if SNAPSHOT
+    // 32K block without files fits any run, its first entry is still probed in case the snapshot is stale
+    bool known_free = block % SECTORS_PER_BLOCK == 0 && !Snapshot_used(block / SECTORS_PER_BLOCK);
+#endif
+    uint8_t status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, FE_PROBE_SIZE);
+    if (status != W25Q64FV_OK) {
+      return status;
+    }
+#if STATS
+    entries_scanned++;
+#endif
+#if SNAPSHOT
+    if (known_free && fe->block == 0xffff) {
+      *pblock = block;
+      return OK;
+    } else if (known_free) {
+      Snapshot_invalidate();
     }
-    strncpy(name, input, name_len);
-    for (size_t i = name_len; i < MAX_NAME_SIZE; i++) {
-        name[i] = '\0';
+#endif
+    if (fe->block != 0xffff) {
+#if UPDATE
+      // Sectors left behind by an interrupted update are reclaimed
+      if (!is_live(fe)) {
+        status = erase_file(block, fe);
+        if (status != W25Q64FV_OK) {
+          return status;
+        }
+        continue;
+      }
+#endif
+      run = 0;
+      block += FE_SECTORS(fe);
+      continue;
     }
-
-    // Parse the start value
-    const char *current = hash + 1;
-    char *endptr;
-    *pstart = (uint16_t) strtoul(current, &endptr, 16);
-    if (*endptr != '#') {
-        return false; // Invalid format
+    if (run || (block & (sectors - 1)) == 0) {
+      if (++run == sectors) {
+        *pblock = block + 1 - sectors;
+        return OK;
+      }
     }
+    block++;
+  }
+  return FILE_ENTRY_IS_NOT_FOUND;
+}
 
-    // Parse the size value
-    current = endptr + 1;
-    *pstop = (uint16_t) strtoul(current, &endptr, 16);
+uint8_t find_free(uint8_t *buff, uint16_t *pblock, uint8_t sectors) {
+#if SNAPSHOT
+  // Sectors below the cursor are taken, holes left there by failed writes are used once the rest is full
+  uint16_t block = Snapshot_cursor();
+  if (block > *pblock) {
+    uint8_t status = find_free_from(buff, &block, sectors);
+    if (status == OK) {
+      *pblock = block;
+    }
+    if (status != FILE_ENTRY_IS_NOT_FOUND) {
+      return status;
+    }
+  }
+#endif
+  return find_free_from(buff, pblock, sectors);
+}
+#endif
 
-    return true; // Successfully parsed
+#if SNAPSHOT
+// Directory state comes from the EEPROM snapshot if it matches flash, otherwise headers are scanned
+// once to rebuild it. Leftovers of interrupted updates count as used. buff gets overwritten
+uint8_t SimpleFS_mount(uint8_t *buff) {
+  if (Snapshot_begin(buff)) {
+    return OK;
+  }
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint8_t *used = buff + PAGE_SIZE - SNAPSHOT_MAX_BLOCKS / 8;
+  memset(used, 0, SNAPSHOT_MAX_BLOCKS / 8);
+  uint16_t max_sectors = MAX_SECTORS, cursor = max_sectors;
+  for (uint16_t block = 0; block < max_sectors; ) {
+    uint8_t status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, FE_PROBE_SIZE);
+    if (status != W25Q64FV_OK) {
+      return status;
+    }
+#if STATS
+    entries_scanned++;
+#endif
+    if (fe->block == 0xffff) {
+      if (cursor == max_sectors) {
+        cursor = block;
+      }
+      block++;
+      continue;
+    }
+    uint16_t block32 = block / SECTORS_PER_BLOCK;
+    used[block32 / 8] |= 1 << (block32 & 7);
+    block += FE_SECTORS(fe);
+  }
+  Snapshot_store(used, cursor);
+  return OK;
 }
 #endif
 
@@ -102,62 +302,137 @@ bool parseWriteFileInput(const char *input, char *name, uint16_t *pstart, uint16
 static uint32_t current_page_address;
 #endif
 
+#if CRC && WRITE
+static uint32_t current_header_address;
+#endif
+
+#if CRC && (READ || WRITE)
+static uint16_t current_remaining;  // bytes of the file left to stream, including FileEntry_t
+static uint32_t current_crc;
+static uint32_t expected_crc;
+static bool expected_crc_valid;
+
+// Accumulate CRC over file data in the page, offset skips FileEntry_t on the first page
+void crc_page(const uint8_t *buff, uint16_t offset) {
+  if (!current_remaining) {
+    return;
+  }
+  uint16_t n = current_remaining < PAGE_SIZE ? current_remaining : PAGE_SIZE;
+  current_crc = crc32_update(current_crc, buff + offset, n - offset);
+  current_remaining -= n;
+}
+#endif
+
 #if LIST
-uint8_t SimpleFS_listFiles(uint8_t *buff, uint16_t *pblock, const char *prefix) {
-  return find_entry(buff, pblock, nameBeginsWith, (void *)prefix);
+uint8_t SimpleFS_listFiles(uint8_t *buff, uint16_t *pblock, const char *pattern) {
+  return find_entry(buff, pblock, -1, nameMatches, (void *)pattern);
+}
+
+// Block following the file entry in buff found at given block, to continue listing from
+uint16_t SimpleFS_nextBlock(uint8_t *buff, uint16_t block) {
+  return block + FE_SECTORS((FileEntry_t *)buff);
 }
 #endif
 
 #if WRITE
-uint8_t SimpleFS_createFileEntry(uint8_t *buff, const char *input, uint16_t *pblock, uint16_t *psize) {
-  uint8_t status = find_entry(buff, pblock, availableEntry, (void*)0);
+// Name is stored in upper case, truncated to MAX_NAME_SIZE - 1. The file must fit 6502 memory from start
+uint8_t SimpleFS_createFileEntry(uint8_t *buff, const char *name, uint16_t start, uint16_t size, uint16_t *pblock, uint16_t *psize) {
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  if (!*name || (uint32_t)start + size > 0x10000UL) {
+    return INVALID_DATA;
+  }
+  uint8_t cls = SimpleFS_sizeClass(size);
+  uint8_t status = find_free(buff, pblock, 1 << cls);
   if (status == OK) {
+#if SNAPSHOT
+    snapshot_taken(*pblock, 1 << cls);
+#endif
     memset(buff, 0, PAGE_SIZE);
-    FileEntry_t *fe = (FileEntry_t *)buff;
-    uint16_t stop;
-    if (!parseWriteFileInput(input, fe->name, &(fe->start), &stop) || fe->start > stop) {
-      return INVALID_DATA;
+    for (uint8_t i = 0; i < MAX_NAME_SIZE - 1 && name[i]; i++) {
+      fe->name[i] = toupper((unsigned char)name[i]);
     }
+    fe->start = start;
     fe->block = *pblock;
-    fe->size = stop - fe->start;
+    fe->hash = SimpleFS_nameHash(name);
+    fe->flags = FE_FLAGS_VALID | (cls << FE_CLASS_SHIFT);
+    fe->size = size;
     *psize = sizeof(FileEntry_t) + fe->size;
-    current_page_address = ((uint32_t)*pblock) * BLOCK_SIZE;
+    current_page_address = ((uint32_t)*pblock) * SECTOR_SIZE;
+#if CRC
+    // crc is left erased, it gets programmed once the last page is written
+    fe->flags |= FE_FLAG_CRC;
+    fe->crc = 0xffffffff;
+    current_remaining = *psize;
+    current_crc = CRC32_INIT;
+    current_header_address = current_page_address;
+#endif
   }
   return status;
 }
 
 uint8_t SimpleFS_writeFile(uint8_t *buff) {
+#if CRC
+  bool first_page = current_page_address == current_header_address;
+  crc_page(buff, first_page ? sizeof(FileEntry_t) : 0);
+#endif
   W25Q64FV_enable_writing();
   W25Q64FV_write_page(current_page_address, buff);
   W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+#if CRC
+  if (!current_remaining) {
+    uint32_t crc = crc32_final(current_crc);
+    uint32_t address = current_header_address + offsetof(FileEntry_t, crc);
+    W25Q64FV_enable_writing();
+    W25Q64FV_write_bytes(address, (uint8_t *)&crc, sizeof(crc));
+    W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+  }
+#endif
   current_page_address += PAGE_SIZE;
   return W25Q64FV_OK;
 }
 #endif
 
 #if READ
+#if CRC
+// Start CRC verification, buff holds the first page of the file
+void crc_begin(uint8_t *buff) {
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  expected_crc = fe->crc;
+  expected_crc_valid = (fe->flags & (FE_FLAGS_VALID | FE_FLAG_CRC)) == (FE_FLAGS_VALID | FE_FLAG_CRC);
+  current_remaining = sizeof(FileEntry_t) + fe->size;
+  current_crc = CRC32_INIT;
+  crc_page(buff, sizeof(FileEntry_t));
+}
+#endif
+
 uint8_t SimpleFS_readFileByName(uint8_t *buff, const char *filename, uint16_t *psize) {
   uint16_t block = 0;
-  uint8_t status = find_entry(buff, &block, nameExactMatch, (void *)filename);
+  uint8_t status = find_entry(buff, &block, SimpleFS_nameHash(filename), nameExactMatch, (void *)filename);
   if (status == OK) {
     FileEntry_t *fe = (FileEntry_t *)buff;
-    current_page_address = ((uint32_t)block) * BLOCK_SIZE;
+    current_page_address = ((uint32_t)block) * SECTOR_SIZE;
     *psize = sizeof(FileEntry_t) + fe->size;
     status = W25Q64FV_read_page(current_page_address, buff, PAGE_SIZE);
+#if CRC
+    crc_begin(buff);
+#endif
   }
   return status;
 }
 
 uint8_t SimpleFS_readFileByBlockNo(uint8_t *buff, uint16_t block, uint16_t *psize) {
-  uint8_t status = W25Q64FV_read_page(block * BLOCK_SIZE, buff, sizeof(FileEntry_t));
+  uint8_t status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, sizeof(FileEntry_t));
   if (status != W25Q64FV_OK) {
     return status;
   }
   FileEntry_t *fe = (FileEntry_t *)buff;
-  if (fe->block == block) {
-    current_page_address = ((uint32_t)block) * BLOCK_SIZE;
+  if (fe->block == block && is_live(fe)) {
+    current_page_address = ((uint32_t)block) * SECTOR_SIZE;
     *psize = sizeof(FileEntry_t) + fe->size;
     status = W25Q64FV_read_page(current_page_address, buff, PAGE_SIZE);
+#if CRC
+    crc_begin(buff);
+#endif
   } else {
     status = BLOCK_IS_NOT_VALID;
   }
@@ -166,35 +441,370 @@ uint8_t SimpleFS_readFileByBlockNo(uint8_t *buff, uint16_t block, uint16_t *psiz
 
 uint8_t SimpleFS_readFileNextPage(uint8_t *buff) {
   current_page_address += PAGE_SIZE;
+  uint8_t status = W25Q64FV_read_page(current_page_address, buff, PAGE_SIZE);
+#if CRC
+  crc_page(buff, 0);
+#endif
+  return status;
+}
+
+#if PREFETCH
+static uint16_t prefetch_block = 0xffff;
+
+// First page of the file is read ahead into buff, read state is set up as by SimpleFS_readFileByBlockNo
+uint8_t SimpleFS_prefetch(uint8_t *buff, uint16_t block) {
+  uint16_t size;
+  uint8_t status = SimpleFS_readFileByBlockNo(buff, block, &size);
+  prefetch_block = status == OK ? block : 0xffff;
+  return status;
+}
+
+// Any other use of buff or of the read state drops the page read ahead
+void SimpleFS_prefetchDrop() {
+  prefetch_block = 0xffff;
+}
+
+// A request overwrites no more than FileEntry_t of the page read ahead, so only the entry is read again.
+// The page is used if the entry still starts a live file, addressed by the same name, or by block if the name is empty
+uint8_t SimpleFS_readPrefetched(uint8_t *buff, const char *name, uint16_t block, uint16_t *psize) {
+  uint16_t prefetched = prefetch_block;
+  prefetch_block = 0xffff;
+  if (prefetched == 0xffff) {
+    return FILE_ENTRY_IS_NOT_FOUND;
+  }
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint8_t status = W25Q64FV_read_page(((uint32_t)prefetched) * SECTOR_SIZE, buff, sizeof(FileEntry_t));
+  if (status != W25Q64FV_OK) {
+    return status;
+  }
+  if (fe->block != prefetched || !is_live(fe) || (*name ? !nameExactMatch(fe, (void *)name) : block != prefetched)) {
+    return FILE_ENTRY_IS_NOT_FOUND;
+  }
+  *psize = sizeof(FileEntry_t) + fe->size;
+  return OK;
+}
+#endif
+
+// Ranged reads and handles start at the offset within file data. Flash reads are not bound to pages,
+// next pages follow from the offset. CRC is not verified for a part of the file
+uint8_t read_from(uint8_t *buff, uint16_t block, uint16_t offset, uint16_t length, uint16_t size, uint16_t *psize) {
+  if (offset > size) {
+    return INVALID_DATA;
+  }
+  *psize = size - offset < length ? size - offset : length;
+  current_page_address = ((uint32_t)block) * SECTOR_SIZE + sizeof(FileEntry_t) + offset;
+#if CRC
+  expected_crc_valid = false;
+  current_remaining = 0;
+#endif
   return W25Q64FV_read_page(current_page_address, buff, PAGE_SIZE);
 }
+
+// File is addressed by name, or by block if the name is empty. Stored bytes of a compressed file are addressed,
+// *psize is set to number of bytes to stream, clipped to the end of the file
+uint8_t SimpleFS_readFileRange(uint8_t *buff, const char *name, uint16_t block, uint16_t offset, uint16_t length, uint16_t *psize) {
+  uint8_t status = find_file(buff, name, &block);
+  if (status != OK) {
+    return status;
+  }
+  return read_from(buff, block, offset, length, ((FileEntry_t *)buff)->size, psize);
+}
+
+// buff gets the file entry, the file is addressed as by SimpleFS_readFileRange
+uint8_t SimpleFS_statFile(uint8_t *buff, const char *name, uint16_t block) {
+  return find_file(buff, name, &block);
+}
+
+#if HANDLES
+typedef struct {
+  bool open;
+  uint16_t block;
+  uint16_t pos;     // offset within file data
+  uint16_t size;
+} Handle_t;
+
+static Handle_t handles[MAX_HANDLES];
+
+// Returns NULL unless the handle is open
+Handle_t *get_handle(uint16_t h) {
+  return h < MAX_HANDLES && handles[h].open ? &handles[h] : NULL;
+}
+
+// File is addressed by name, or by block if the name is empty, buff gets the file entry
+uint8_t SimpleFS_openFile(uint8_t *buff, const char *name, uint16_t block, uint8_t *phandle) {
+  uint8_t h = 0;
+  while (h < MAX_HANDLES && handles[h].open) {
+    h++;
+  }
+  if (h == MAX_HANDLES) {
+    return TOO_MANY_HANDLES;
+  }
+  uint8_t status = find_file(buff, name, &block);
+  if (status == OK) {
+    handles[h].open = true;
+    handles[h].block = block;
+    handles[h].pos = 0;
+    handles[h].size = ((FileEntry_t *)buff)->size;
+    *phandle = h;
+#if CRC
+    expected_crc_valid = false;
+#endif
+  }
+  return status;
+}
+
+// Position moves past the bytes to stream, the entry is probed to make sure
+// the file has not been deleted or moved meanwhile
+uint8_t SimpleFS_readHandle(uint8_t *buff, uint16_t h, uint16_t length, uint16_t *psize) {
+  Handle_t *handle = get_handle(h);
+  if (!handle) {
+    return INVALID_HANDLE;
+  }
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  uint8_t status = W25Q64FV_read_page(handle->block * SECTOR_SIZE, buff, FE_PROBE_SIZE);
+  if (status == W25Q64FV_OK && (fe->block != handle->block || !is_live(fe))) {
+    status = BLOCK_IS_NOT_VALID;
+  }
+  if (status == OK) {
+    status = read_from(buff, handle->block, handle->pos, length, handle->size, psize);
+  }
+  if (status == OK) {
+    handle->pos += *psize;
+  }
+  return status;
+}
+
+uint8_t SimpleFS_seekHandle(uint16_t h, uint16_t offset) {
+  Handle_t *handle = get_handle(h);
+  if (!handle) {
+    return INVALID_HANDLE;
+  }
+  if (offset > handle->size) {
+    return INVALID_DATA;
+  }
+  handle->pos = offset;
+  return OK;
+}
+
+uint8_t SimpleFS_closeHandle(uint16_t h) {
+  Handle_t *handle = get_handle(h);
+  if (!handle) {
+    return INVALID_HANDLE;
+  }
+  handle->open = false;
+  return OK;
+}
+#endif
+
+// Call once all pages are read. Files written without CRC are accepted as is
+uint8_t SimpleFS_verifyFile() {
+#if CRC
+  if (expected_crc_valid && (current_remaining || crc32_final(current_crc) != expected_crc)) {
+    return CRC_MISMATCH;
+  }
+#endif
+  return OK;
+}
+#endif
+
+#if UPDATE
+static uint32_t update_address;     // file being updated
+static uint32_t update_copy;        // erased sectors reserved for copy-on-write replacement
+static bool update_copying;         // false while pages are programmed in place
+static uint16_t update_pos;         // offset from the entry of the next byte to update
+static uint16_t update_end;         // sizeof(FileEntry_t) + size of the file
+
+// Program bytes within a page
+uint8_t program_bytes(uint32_t address, uint8_t *data, uint16_t size) {
+  W25Q64FV_enable_writing();
+  W25Q64FV_write_bytes(address, data, size);
+  return W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+}
+
+// Copy [from, to) of the file into its replacement, chunks are aligned so they never cross a page
+uint8_t copy_range(uint16_t from, uint16_t to) {
+  uint8_t chunk[sizeof(FileEntry_t)];
+  while (from < to) {
+    uint16_t n = sizeof(chunk) - from % sizeof(chunk);
+    if (n > to - from) {
+      n = to - from;
+    }
+    uint8_t status = W25Q64FV_read_page(update_address + from, chunk, n);
+    if (status == W25Q64FV_OK) {
+      status = program_bytes(update_copy + from, chunk, n);
+    }
+    if (status != W25Q64FV_OK) {
+      return status;
+    }
+    from += n;
+  }
+  return OK;
+}
+
+// True if data can be programmed over flash contents, i.e. it only clears bits
+bool only_clears_bits(uint32_t address, const uint8_t *data, uint16_t size) {
+  uint8_t chunk[sizeof(FileEntry_t)];
+  for (uint16_t i = 0; i < size; i += sizeof(chunk)) {
+    uint16_t n = size - i < sizeof(chunk) ? size - i : sizeof(chunk);
+    if (W25Q64FV_read_page(address + i, chunk, n) != W25Q64FV_OK) {
+      return false;
+    }
+    for (uint16_t j = 0; j < n; j++) {
+      if ((chunk[j] & data[i + j]) != data[i + j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Start the replacement, copy the entry and data preceding update_pos into it.
+// The copy stays pending, so lookups keep finding the original until updateFinish
+uint8_t begin_copy() {
+  FileEntry_t fe;
+  uint8_t status = W25Q64FV_read_page(update_address, (uint8_t *)&fe, sizeof(fe));
+  if (status != W25Q64FV_OK) {
+    return status;
+  }
+  update_copying = true;
+  fe.block = update_copy / SECTOR_SIZE;
+#if SNAPSHOT
+  snapshot_taken(fe.block, FE_SECTORS(&fe));
+#endif
+  fe.flags |= FE_FLAG_PENDING;
+#if CRC
+  // crc is programmed by updateFinish
+  fe.flags |= FE_FLAG_CRC;
+  fe.crc = 0xffffffff;
+#endif
+  status = program_bytes(update_copy, (uint8_t *)&fe, sizeof(fe));
+  if (status != W25Q64FV_OK) {
+    return status;
+  }
+  return copy_range(sizeof(FileEntry_t), update_pos);
+}
+
+// Clear bits of the flags byte in the entry at given address
+uint8_t clear_flags(uint32_t address, uint8_t mask) {
+  uint8_t flags;
+  uint8_t status = W25Q64FV_read_page(address + offsetof(FileEntry_t, flags), &flags, 1);
+  if (status == W25Q64FV_OK) {
+    flags &= ~mask;
+    status = program_bytes(address + offsetof(FileEntry_t, flags), &flags, 1);
+  }
+  return status;
+}
+
+// File is addressed by name, or by block if the name is empty. The file keeps its size. Pages are programmed in place while new data only clears bits, otherwise
+// the file is copied into erased sectors and the copy replaces it. Those are reserved up front, so the update fails before
+// anything is changed if there is no room. *pidx is index in the page buffer the first data byte goes to
+uint8_t SimpleFS_updateBegin(uint8_t *buff, const char *name, uint16_t block, uint16_t offset, uint16_t length, uint16_t *psize, uint16_t *pidx) {
+  uint8_t status = find_file(buff, name, &block);
+  if (status != OK) {
+    return status;
+  }
+  FileEntry_t *fe = (FileEntry_t *)buff;
+  if (offset > fe->size || length > fe->size - offset) {
+    return INVALID_DATA;
+  }
+  update_address = ((uint32_t)block) * SECTOR_SIZE;
+  update_copying = false;
+  update_pos = sizeof(FileEntry_t) + offset;
+  update_end = sizeof(FileEntry_t) + fe->size;
+
+  uint16_t spare = 0;
+  status = find_free(buff, &spare, FE_SECTORS(fe));
+  if (status != OK) {
+    return status;
+  }
+  update_copy = ((uint32_t)spare) * SECTOR_SIZE;
+  *psize = length;
+  *pidx = update_pos % PAGE_SIZE;
+  return OK;
+}
+
+// buff holds new data from index update_pos % PAGE_SIZE up to the end of the page at most
+uint8_t SimpleFS_updateWrite(uint8_t *buff, uint16_t size) {
+  uint8_t *data = buff + update_pos % PAGE_SIZE;
+  uint8_t status = OK;
+  if (!size) {
+    return OK;
+  }
+  if (!update_copying && !only_clears_bits(update_address + update_pos, data, size)) {
+    status = begin_copy();
+  }
+  if (status == OK) {
+    status = program_bytes((update_copying ? update_copy : update_address) + update_pos, data, size);
+  }
+  update_pos += size;
+  return status;
+}
+
+// Replacement is completed and switched over: copy becomes live first, then the original is
+// invalidated and erased. If interrupted, lookups see either version and find_free reclaims leftovers
+uint8_t SimpleFS_updateFinish() {
+  if (!update_copying) {
+#if CRC
+    // File is changed in place, its crc can't be reprogrammed
+    return clear_flags(update_address, FE_FLAG_CRC);
+#else
+    return OK;
+#endif
+  }
+  uint8_t status = copy_range(update_pos, update_end);
+#if CRC
+  if (status == OK) {
+    uint8_t chunk[sizeof(FileEntry_t)];
+    uint32_t crc = CRC32_INIT;
+    for (uint16_t i = sizeof(FileEntry_t); i < update_end && status == OK; i += sizeof(chunk)) {
+      uint16_t n = update_end - i < sizeof(chunk) ? update_end - i : sizeof(chunk);
+      status = W25Q64FV_read_page(update_copy + i, chunk, n);
+      crc = crc32_update(crc, chunk, n);
+    }
+    crc = crc32_final(crc);
+    if (status == OK) {
+      status = program_bytes(update_copy + offsetof(FileEntry_t, crc), (uint8_t *)&crc, sizeof(crc));
+    }
+  }
+#endif
+  if (status == OK) {
+    status = clear_flags(update_copy, FE_FLAG_PENDING);
+  }
+  if (status == OK) {
+    status = clear_flags(update_address, FE_FLAGS_VALID);
+  }
+  if (status == OK) {
+    FileEntry_t fe;
+    status = W25Q64FV_read_page(update_address, (uint8_t *)&fe, FE_PROBE_SIZE);
+    if (status == OK) {
+      status = erase_file(update_address / SECTOR_SIZE, &fe);
+    }
+  }
+  return status;
+}
 #endif
 
 #if DELETE
 uint8_t SimpleFS_deleteFileByName(uint8_t *buff, const char *filename) {
   uint16_t block = 0;
-  uint8_t status = find_entry(buff, &block, nameExactMatch, (void *)filename);
+  uint8_t status = find_entry(buff, &block, SimpleFS_nameHash(filename), nameExactMatch, (void *)filename);
   if (status == OK) {
-    return W25Q64FV_erase_block_32(block * BLOCK_SIZE, true);
+    return erase_file(block, (FileEntry_t *)buff);
   }
   return status;
 }
 
 uint8_t SimpleFS_deleteFileByBlockNo(uint8_t *buff, uint16_t block) {
-#if 0   // force
-    uint8_t status = W25Q64FV_erase_block_64(block * BLOCK_SIZE, true);
-#else
-  uint8_t status = W25Q64FV_read_page(block * BLOCK_SIZE, buff, 32);
+  uint8_t status = W25Q64FV_read_page(block * SECTOR_SIZE, buff, sizeof(FileEntry_t));
   if (status != W25Q64FV_OK) {
     return status;
   }
   FileEntry_t *fe = (FileEntry_t *)buff;
   if (fe->block == block) {
-    status = W25Q64FV_erase_block_32(block * BLOCK_SIZE, true);
+    status = erase_file(block, fe);
   } else {
     status = BLOCK_IS_NOT_VALID;
   }
-#endif
   return status;
 }
 #endif
@@ -10,30 +10,85 @@ Copyright (c) 2025 Arvid Juskaitis
 
 #define PAGE_SIZE 256
 #define BLOCK_SIZE 32768UL
-#define MAX_BLOCKS (8192 / 32)
-#define MAX_NAME_SIZE  26
+#define SECTOR_SIZE 4096UL
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
+#if FLASH_AUTODETECT
+#define FLASH_SIZE W25Q64FV_capacity()  // detected by W25Q64FV_begin
+#else
+#define FLASH_SIZE (8192 * 1024UL)      // W25Q64
+#endif
+#define MAX_BLOCKS ((uint16_t)(FLASH_SIZE / BLOCK_SIZE))
+#define MAX_SECTORS ((uint16_t)(FLASH_SIZE / SECTOR_SIZE))
+#define MAX_NAME_SIZE  18
+
+// File entry flags
+#define FE_FLAGS_VALID  0x80    // set in a file entry, cleared once an update has replaced it
+#define FE_FLAG_CRC     0x01    // crc field holds CRC-32 of the file data
+#define FE_FLAG_LZ      0x02    // data is LZ/RLE compressed, xsize holds expanded size
+#define FE_FLAG_PENDING 0x40    // copy being written by an update, cleared once it is complete
+#define FE_CLASS_SHIFT  4       // size class, file occupies 1 << class sectors
+#define FE_CLASS_MASK   0x30
+
+#define FE_SECTORS(fe)  (1 << (((fe)->flags & FE_CLASS_MASK) >> FE_CLASS_SHIFT))
 
 // Define the structure for a file entry
 typedef struct {
-    uint16_t block;     // Block number, starting from 0
+    uint16_t block;     // Block number in 4 Kb sectors, starting from 0
+    uint8_t hash;       // Hash of the name, to reject entries without reading the name
+    uint8_t flags;      // FE_FLAG_* bits and size class
+    uint32_t crc;       // CRC-32 of the file data (little endian)
     uint16_t start;     // Start address of the file in memory (little endian)
     uint16_t size;      // Te size of the file in memory (little endian)
-    char name[MAX_NAME_SIZE];  // File name, case-insensitive, padded with zeros
+    uint16_t xsize;     // The size of the file expanded in memory, if FE_FLAG_LZ is set
+    char name[MAX_NAME_SIZE];  // File name, upper case, padded with zeros
 } FileEntry_t;
 
+// Directory scan reads only block, hash and flags of every entry
+#define FE_PROBE_SIZE   4
+
+// Files open at the same time, each handle takes 7 bytes of SRAM
+#define MAX_HANDLES     4
+
 // Define status
 typedef enum {
     OK = 0,
     FILE_ENTRY_IS_NOT_FOUND = 10, // 0x0a
     BLOCK_IS_NOT_VALID = 11,      // 0x0c
-    INVALID_DATA = 12             // 0x0c
+    INVALID_DATA = 12,            // 0x0c
+    CRC_MISMATCH = 13,            // 0x0d
+    INVALID_HANDLE = 14,          // 0x0e
+    TOO_MANY_HANDLES = 15         // 0x0f
 } SimpleFS_Status_t;
 
-uint8_t SimpleFS_listFiles(uint8_t *buff, uint16_t *pblock, const char *prefix);
-uint8_t SimpleFS_createFileEntry(uint8_t *buff, const char *input, uint16_t *pblock, uint16_t *psize);
+uint8_t SimpleFS_listFiles(uint8_t *buff, uint16_t *pblock, const char *pattern);
+uint16_t SimpleFS_nextBlock(uint8_t *buff, uint16_t block);
+uint8_t SimpleFS_nameHash(const char *name);
+uint8_t SimpleFS_sizeClass(uint16_t size);
+uint8_t SimpleFS_createFileEntry(uint8_t *buff, const char *name, uint16_t start, uint16_t size, uint16_t *pblock, uint16_t *psize);
 uint8_t SimpleFS_writeFile(uint8_t *buff);
 uint8_t SimpleFS_readFileByName(uint8_t *buff, const char *filename, uint16_t *psize);
 uint8_t SimpleFS_readFileByBlockNo(uint8_t *buff, uint16_t block, uint16_t *psize);
+uint8_t SimpleFS_readFileRange(uint8_t *buff, const char *name, uint16_t block, uint16_t offset, uint16_t length, uint16_t *psize);
 uint8_t SimpleFS_readFileNextPage(uint8_t *buff);
+uint8_t SimpleFS_statFile(uint8_t *buff, const char *name, uint16_t block);
+#if PREFETCH
+uint8_t SimpleFS_prefetch(uint8_t *buff, uint16_t block);
+void SimpleFS_prefetchDrop();
+uint8_t SimpleFS_readPrefetched(uint8_t *buff, const char *name, uint16_t block, uint16_t *psize);
+#endif
+uint8_t SimpleFS_openFile(uint8_t *buff, const char *name, uint16_t block, uint8_t *phandle);
+uint8_t SimpleFS_readHandle(uint8_t *buff, uint16_t h, uint16_t length, uint16_t *psize);
+uint8_t SimpleFS_seekHandle(uint16_t h, uint16_t offset);
+uint8_t SimpleFS_closeHandle(uint16_t h);
+uint8_t SimpleFS_verifyFile();
+uint8_t SimpleFS_updateBegin(uint8_t *buff, const char *name, uint16_t block, uint16_t offset, uint16_t length, uint16_t *psize, uint16_t *pidx);
+uint8_t SimpleFS_updateWrite(uint8_t *buff, uint16_t size);
+uint8_t SimpleFS_updateFinish();
 uint8_t SimpleFS_deleteFileByName(uint8_t *buff, const char *filename);
 uint8_t SimpleFS_deleteFileByBlockNo(uint8_t *buff, uint16_t block);
+#if SNAPSHOT
+uint8_t SimpleFS_mount(uint8_t *buff);
+#endif
+#if STATS
+uint32_t SimpleFS_entriesScanned();
+#endif
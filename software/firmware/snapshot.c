@@ -0,0 +1,118 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <avr/eeprom.h>
+#include "snapshot.h"
+#include "w25q64fv.h"
+
+#if SNAPSHOT
+// Generation is the number of cleared bits of the marker, the register is erased once all are used
+#define MARKER_ADDRESS      W25Q64FV_SECURITY_REGISTER(1)
+#define MARKER_BITS         (W25Q64FV_SECURITY_REGISTER_SIZE * 8)
+#define GENERATION_NONE     0xffff
+#define FLASH_MB            ((uint8_t)(W25Q64FV_capacity() >> 20))
+
+typedef struct {
+  uint16_t generation;      // GENERATION_NONE while the snapshot is being changed
+  uint16_t cursor;          // first sector which may be free
+  uint8_t flash_mb;         // size of the flash the snapshot belongs to
+  uint8_t used[SNAPSHOT_MAX_BLOCKS / 8];
+} Snapshot_t;
+
+static Snapshot_t EEMEM snapshot;
+static uint16_t generation = GENERATION_NONE;
+static bool valid;
+
+// buff gets the marker
+uint16_t read_marker(uint8_t *buff) {
+  if (W25Q64FV_read_security(MARKER_ADDRESS, buff, W25Q64FV_SECURITY_REGISTER_SIZE) != W25Q64FV_OK) {
+    return GENERATION_NONE;
+  }
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < W25Q64FV_SECURITY_REGISTER_SIZE; i++) {
+    for (uint8_t bits = buff[i]; bits != 0xff; bits |= bits + 1) {
+      n++;
+    }
+  }
+  return n;
+}
+
+bool advance_marker() {
+  if (generation >= MARKER_BITS) {
+    if (W25Q64FV_erase_security(MARKER_ADDRESS, true) != W25Q64FV_OK) {
+      return false;
+    }
+    generation = 0;
+  }
+  uint8_t bits = 0xff << (generation % 8 + 1);
+  W25Q64FV_program_security(MARKER_ADDRESS + generation / 8, &bits, 1);
+  if (W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT) != W25Q64FV_OK) {
+    return false;
+  }
+  generation++;
+  return true;
+}
+
+// Snapshot is valid if it was stored for this flash at its current generation, buff gets overwritten
+bool Snapshot_begin(uint8_t *buff) {
+  generation = read_marker(buff);
+  valid = generation != GENERATION_NONE
+    && eeprom_read_word(&snapshot.generation) == generation
+    && eeprom_read_byte(&snapshot.flash_mb) == FLASH_MB;
+  return valid;
+}
+
+// Blocks are reported used unless the snapshot says otherwise
+bool Snapshot_used(uint16_t block32) {
+  if (!valid || block32 >= SNAPSHOT_MAX_BLOCKS) {
+    return true;
+  }
+  return eeprom_read_byte(&snapshot.used[block32 / 8]) & (1 << (block32 & 7));
+}
+
+uint16_t Snapshot_cursor() {
+  return valid ? eeprom_read_word(&snapshot.cursor) : 0;
+}
+
+// Store a snapshot rebuilt by a directory scan at the current generation
+void Snapshot_store(const uint8_t *used, uint16_t cursor) {
+  if (generation == GENERATION_NONE) {
+    return;
+  }
+  eeprom_update_word(&snapshot.generation, GENERATION_NONE);
+  eeprom_update_block(used, snapshot.used, sizeof(snapshot.used));
+  eeprom_update_word(&snapshot.cursor, cursor);
+  eeprom_update_byte(&snapshot.flash_mb, FLASH_MB);
+  eeprom_update_word(&snapshot.generation, generation);
+  valid = true;
+}
+
+// Called once a file is allocated or erased. EEPROM is written only if the block or the cursor change,
+// it is marked invalid meanwhile, so an interrupted commit is caught on the next boot
+void Snapshot_commit(uint16_t block32, bool used, uint16_t cursor) {
+  if (!valid) {
+    return;
+  }
+  uint8_t *p = &snapshot.used[block32 / 8];
+  uint8_t bits = eeprom_read_byte(p);
+  uint8_t changed = used ? bits | (1 << (block32 & 7)) : bits & ~(1 << (block32 & 7));
+  if (changed == bits && cursor == eeprom_read_word(&snapshot.cursor)) {
+    return;
+  }
+  eeprom_update_word(&snapshot.generation, GENERATION_NONE);
+  eeprom_update_byte(p, changed);
+  eeprom_update_word(&snapshot.cursor, cursor);
+  valid = advance_marker();
+  if (valid) {
+    eeprom_update_word(&snapshot.generation, generation);
+  }
+}
+
+// Flash is changed behind SimpleFS or the snapshot turned out stale, it is rebuilt on the next mount
+void Snapshot_invalidate() {
+  valid = false;
+  eeprom_update_word(&snapshot.generation, GENERATION_NONE);
+}
+#endif
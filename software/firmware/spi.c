@@ -4,6 +4,7 @@ Copyright (c) 2025 Arvid Juskaitis
 */
 
 #include "spi.h"
+#include "stats.h"
 
 // Function definitions
 void SPI_init(uint8_t mode, uint8_t clock_div) {
@@ -23,6 +24,7 @@ void SPI_init(uint8_t mode, uint8_t clock_div) {
 }
 
 uint8_t SPI_transfer(uint8_t data) {
+    STATS_SPI_BYTE();
     SPDR = data;                      // Load data into the buffer
     while (!(SPSR & (1 << SPIF)));    // Wait until transmission is complete
     return SPDR;                      // Return received data
@@ -0,0 +1,176 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "stats.h"
+#include "timer.h"
+
+#if STATS
+#include "simplefs.h"
+#include "uart.h"
+#include "iostat.h"
+
+Stats_t stats;
+static uint8_t timed_slot = 0xff;           // command being timed, 0xff - none
+static uint32_t timed_start;
+static uint32_t timed_spi;
+
+void Stats_commandBegin(uint8_t slot) {
+    timed_slot = slot;
+    timed_start = Timer_now();
+    timed_spi = stats.spi_bytes;
+}
+
+// Called while idle, records the command once it is complete
+void Stats_commandEnd() {
+    if (timed_slot == 0xff) {
+        return;
+    }
+    uint32_t cycles = Timer_now() - timed_start;
+    uint32_t spi = stats.spi_bytes - timed_spi;
+    stats.cmd_spi = spi < 0xffff ? spi : 0xffff;
+    if (timed_slot < STATS_HISTOGRAMS) {
+        uint8_t *hist = stats.hist[timed_slot];
+        uint8_t bucket = 0;
+        for (uint32_t limit = F_CPU / 1000; bucket < STATS_BUCKETS - 1 && cycles >= limit; limit <<= 3) {
+            bucket++;
+        }
+        if (hist[bucket] == 0xff) {
+            for (uint8_t i = 0; i < STATS_BUCKETS; i++) {
+                hist[i] >>= 1;
+            }
+        }
+        hist[bucket]++;
+    }
+    timed_slot = 0xff;
+}
+
+// waited - cycles the MCU spent polling, elapsed - duration of op since it was issued
+void Stats_flash(uint8_t op, uint32_t waited, uint32_t elapsed) {
+    stats.busy_cycles += waited;
+    if (op < W25Q64FV_OPS) {
+        uint32_t ticks = elapsed / TIMER_TICK_CYCLES;
+        uint16_t t = ticks < 0xffff ? ticks : 0xffff;
+        if (t > stats.flash_max[op]) {
+            stats.flash_max[op] = t;
+        }
+    }
+}
+
+uint8_t Stats_record(uint8_t *buff) {
+    uint32_t scanned = SimpleFS_entriesScanned();
+    uint8_t sreg = SREG;
+    cli();  // INT0 updates isr_cycles
+    memcpy(buff, &stats, sizeof(Stats_t));
+    SREG = sreg;
+    memcpy(buff + sizeof(Stats_t), &scanned, sizeof(scanned));
+    uint8_t *p = buff + sizeof(Stats_t) + sizeof(scanned);
+    for (uint8_t op = 0; op < W25Q64FV_OPS; op++) {
+        uint16_t expected = W25Q64FV_expected(op);
+        memcpy(p + 2 * op, &expected, sizeof(expected));
+    }
+    return STATS_RECORD_SIZE;
+}
+
+static void dump_value(const char *name, uint32_t value) {
+    char s[11];
+    uart_transmit_string_P(name);
+    uart_transmit_string(ultoa(value, s, 10));
+}
+
+static void dump_histogram(const char *name, const uint8_t *hist) {
+    for (uint8_t i = 0; i < STATS_BUCKETS; i++) {
+        dump_value(i ? PSTR(",") : name, hist[i]);
+    }
+}
+
+// Single line of space separated name=value pairs, histograms are comma separated buckets
+void Stats_dump() {
+    cli();  // INT0 updates isr_cycles, USART interrupt updates uart_errors
+    uint32_t isr_cycles = stats.isr_cycles;
+    uint16_t isr_max = stats.isr_max;
+    UartErrors_t errors = uart_errors;
+    sei();
+    dump_value(PSTR("isr="), isr_cycles);
+    dump_value(PSTR(" isr_max="), isr_max);
+    dump_value(PSTR(" busy="), stats.busy_cycles);
+    dump_value(PSTR(" spi="), stats.spi_bytes);
+    dump_value(PSTR(" cmd_spi="), stats.cmd_spi);
+    dump_value(PSTR(" scanned="), SimpleFS_entriesScanned());
+    dump_histogram(PSTR(" list="), stats.hist[STATS_LIST]);
+    dump_histogram(PSTR(" read="), stats.hist[STATS_READ]);
+    dump_histogram(PSTR(" write="), stats.hist[STATS_WRITE]);
+    dump_histogram(PSTR(" delete="), stats.hist[STATS_DELETE]);
+    dump_value(PSTR(" uart_fe="), errors.frame);
+    dump_value(PSTR(" uart_dor="), errors.overrun);
+    dump_value(PSTR(" uart_drop="), errors.dropped);
+#if IOSTAT
+    // flash commands of the last command or file request
+    dump_value(PSTR(" io_reads="), iostat[0].reads);
+    dump_value(PSTR(" io_rbytes="), iostat[0].read_bytes);
+    dump_value(PSTR(" io_programs="), iostat[0].programs);
+    dump_value(PSTR(" io_pbytes="), iostat[0].program_bytes);
+    dump_value(PSTR(" io_erases="), iostat[0].erases);
+    dump_value(PSTR(" io_polls="), iostat[0].polls);
+#endif
+    // page program, program, 4K erase, 32K erase, chip erase, in timer ticks
+    for (uint8_t op = 0; op < W25Q64FV_OPS; op++) {
+        dump_value(op ? PSTR(",") : PSTR(" flash_avg="), W25Q64FV_expected(op));
+    }
+    for (uint8_t op = 0; op < W25Q64FV_OPS; op++) {
+        dump_value(op ? PSTR(",") : PSTR(" flash_max="), stats.flash_max[op]);
+    }
+    uart_transmit_string_P(PSTR("\r\n"));
+}
+
+#if TRACE
+static TraceEntry_t trace[TRACE_SIZE];
+static uint8_t trace_idx;           // next entry to be overwritten, the oldest one
+
+// Called by INT0 and the main loop
+void Trace_record(uint8_t kind, uint8_t data) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t now = Timer_now();
+    TraceEntry_t *e = &trace[trace_idx];
+    trace_idx = (trace_idx + 1) & (TRACE_SIZE - 1);
+    e->kind = kind;
+    e->data = data;
+    memcpy(e->time, (uint8_t *)&now + 1, sizeof(e->time));
+    SREG = sreg;
+}
+
+static void put_hex(uint8_t value) {
+    static const char digits[] PROGMEM = "0123456789ABCDEF";
+    uart_transmit(pgm_read_byte(&digits[value >> 4]));
+    uart_transmit(pgm_read_byte(&digits[value & 0x0f]));
+}
+
+// Header line, then "KKDDTTTTTT" per entry, oldest first, time is big endian. software/utils/trace_decode.py reads it
+void Trace_dump(uint8_t strobe) {
+    dump_value(PSTR("trace f_cpu="), F_CPU);
+    dump_value(PSTR(" tick="), TIMER_TICK_CYCLES);
+    dump_value(PSTR(" strobe="), strobe);   // cycles
+    uart_transmit_string_P(PSTR("\r\n"));
+    uint8_t idx = trace_idx;
+    for (uint8_t i = 0; i < TRACE_SIZE; i++) {
+        TraceEntry_t *e = &trace[(idx + i) & (TRACE_SIZE - 1)];
+        if (!e->kind) {
+            continue;   // not recorded yet
+        }
+        put_hex(e->kind);
+        put_hex(e->data);
+        put_hex(e->time[2]);
+        put_hex(e->time[1]);
+        put_hex(e->time[0]);
+        uart_transmit_string_P(PSTR("\r\n"));
+    }
+    uart_transmit_string_P(PSTR("end\r\n"));
+}
+#endif
+#endif
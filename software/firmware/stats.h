@@ -0,0 +1,85 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "defs.h"
+#include "w25q64fv.h"
+
+// Commands which get a latency histogram
+#define STATS_LIST      0
+#define STATS_READ      1
+#define STATS_WRITE     2
+#define STATS_DELETE    3
+#define STATS_OTHER     4   // timed, no histogram
+#define STATS_HISTOGRAMS    4
+// Buckets grow by 8x from 1ms: <1ms, <8ms, <64ms, <512ms, <4s, longer
+#define STATS_BUCKETS       6
+
+// Durations are in CPU cycles, counters are sent as is by CMD_STATS, little endian
+typedef struct {
+    uint32_t isr_cycles;    // spent in INT0
+    uint16_t isr_max;       // longest INT0
+    uint32_t busy_cycles;   // spent in W25Q64FV_wait_until_free
+    uint32_t spi_bytes;     // transferred over SPI
+    uint16_t cmd_spi;       // SPI bytes of the last command
+    uint8_t hist[STATS_HISTOGRAMS][STATS_BUCKETS];  // halved when a bucket would overflow
+    uint16_t flash_max[W25Q64FV_OPS];   // longest flash operation in timer ticks, see W25Q64FV_op_t
+} Stats_t;
+
+// CMD_STATS reply, Stats_t followed by number of directory entries probed
+// and expected durations of flash operations in timer ticks
+#define STATS_RECORD_SIZE   (sizeof(Stats_t) + 4 + 2 * W25Q64FV_OPS)
+
+// Trace ring of the last bus events, dumped on 't'. Kind is in upper nibble, state in lower one
+#define TRACE_SIZE      32  // power of 2
+#define TR_IN           0x10    // INT0 entry, data - byte from CPU
+#define TR_RELEASE      0x20    // latch released, data - cycles in INT0 until strobe started
+#define TR_TAKE         0x30    // main loop took the byte, data - byte from CPU
+#define TR_OUT          0x40    // reply to CPU, data - MCU_OUT
+#define TR_FLASH        0x50    // waiting for flash to complete program or erase, data - W25Q64FV_op_t
+#define TR_FLASH_END    0x60
+
+typedef struct {
+    uint8_t kind;
+    uint8_t data;
+    uint8_t time[3];        // bits 8-31 of the cycle counter, little endian
+} TraceEntry_t;
+
+#if STATS
+extern Stats_t stats;
+
+void Stats_commandBegin(uint8_t slot);
+void Stats_commandEnd();
+uint8_t Stats_record(uint8_t *buff);
+void Stats_dump();
+
+void Stats_flash(uint8_t op, uint32_t waited, uint32_t elapsed);
+
+// A few cycles per event
+#define STATS_FLASH(op, waited, elapsed) Stats_flash(op, waited, elapsed)
+#define STATS_ISR_END(t)        do { uint16_t d_ = TCNT1 - t; stats.isr_cycles += d_; \
+                                    if (d_ > stats.isr_max) stats.isr_max = d_; } while (0)
+#define STATS_SPI_BYTE()        (stats.spi_bytes++)
+#if TRACE
+void Trace_record(uint8_t kind, uint8_t data);
+void Trace_dump(uint8_t strobe);
+#define TRACE_EVENT(kind, data) Trace_record(kind, data)
+#else
+#define Trace_dump(strobe)      /**/
+#define TRACE_EVENT(kind, data) /**/
+#endif
+#else
+#define Stats_commandBegin(s)   /**/
+#define Stats_commandEnd()      /**/
+#define Stats_dump()            /**/
+#define STATS_FLASH(op, waited, elapsed) /**/
+#define STATS_ISR_END(t)        /**/
+#define STATS_SPI_BYTE()        /**/
+#define Trace_dump(strobe)      /**/
+#define TRACE_EVENT(kind, data) /**/
+#endif
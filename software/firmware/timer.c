@@ -0,0 +1,33 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timer.h"
+
+static volatile uint16_t timer_overflows;   // upper word of the cycle counter
+
+ISR(TIMER1_OVF_vect) {
+    timer_overflows++;
+}
+
+void Timer_init() {
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);   // no prescaler, counts CPU cycles
+    TIMSK |= (1 << TOIE1);
+}
+
+// 32-bit cycle counter, wraps in 9 minutes at 8MHz
+uint32_t Timer_now() {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t lo = TCNT1;
+    uint16_t hi = timer_overflows;
+    if ((TIFR & (1 << TOV1)) && lo < 0x8000) {
+        hi++;   // overflow is pending
+    }
+    SREG = sreg;
+    return ((uint32_t)hi << 16) | lo;
+}
@@ -0,0 +1,16 @@
+/*
+RC6502 FLASH (W25Q64F) Card firmware
+Copyright (c) 2025 Arvid Juskaitis
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Timer1 counts CPU cycles without prescaler, overflows extend it to 32 bits
+#define TIMER_TICK_CYCLES   256     // coarse unit for stored durations, 32us at 8MHz
+#define US_TO_CYCLES(us)    ((uint32_t)(us) * (F_CPU / 1000000UL))
+#define US_TO_TICKS(us)     (US_TO_CYCLES(us) / TIMER_TICK_CYCLES)
+
+void Timer_init();
+uint32_t Timer_now();
@@ -4,25 +4,56 @@ Copyright (c) 2025 Arvid Juskaitis
 */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include "defs.h"
 #include "uart.h"
 
+// Rings are filled and drained by USART interrupts, so bytes keep arriving and leaving while
+// the main loop is busy. Host waits for a reply after each page or frame, so the rings only
+// cover main loop latency, they are kept small for the 512 bytes of SRAM
+#define RX_RING_SIZE    8   // power of 2
+#define TX_RING_SIZE    8   // power of 2
+
+static volatile uint8_t rx_ring[RX_RING_SIZE];
+static volatile uint8_t rx_head, rx_tail;   // head is written by the ISR only, tail by the main loop only
+static volatile uint8_t tx_ring[TX_RING_SIZE];
+static volatile uint8_t tx_head, tx_tail;   // head is written by the main loop only, tail by the ISR only
+
+volatile UartErrors_t uart_errors;
+
 // Initialize UART
 void uart_init(unsigned int ubrr) {
     // Set baud rate
     UBRRH = (unsigned char)(ubrr >> 8);
     UBRRL = (unsigned char)ubrr;
-    // Enable transmitter and receiver
-    UCSRB = (1 << RXEN) | (1 << TXEN);
+    // Enable transmitter, receiver and receive interrupt, data register empty one is enabled while TX ring has data
+    UCSRB = (1 << RXEN) | (1 << TXEN) | (1 << RXCIE);
     // Set frame format: 8 data bits, 1 stop bit
     UCSRC = (1 << URSEL) | (1 << UCSZ1) | (1 << UCSZ0);
 }
 
-// Transmit a character
-void uart_transmit(unsigned char data) {
-    // Wait for empty transmit buffer
+#if BULK_RATE
+// Change the rate, with U2X baud is F_CPU / 8 / (ubrr + 1), so 8 MHz gives 500000 and 1000000 exactly
+void uart_set_rate(unsigned int ubrr, char double_speed) {
+    // TX ring is sent and the last character leaves the shift register, 10 bits at 250000 baud take 40us
+    while (tx_head != tx_tail);
     while (!(UCSRA & (1 << UDRE)));
-    // Put data into buffer, sends the data
-    UDR = data;
+    _delay_us(50);
+    UBRRH = (unsigned char)(ubrr >> 8);
+    UBRRL = (unsigned char)ubrr;
+    UCSRA = double_speed ? (1 << U2X) : 0;
+}
+#endif
+
+// Transmit a character, waits only while TX ring is full
+void uart_transmit(unsigned char data) {
+    uint8_t next = (tx_head + 1) & (TX_RING_SIZE - 1);
+    while (next == tx_tail);
+    tx_ring[tx_head] = data;
+    tx_head = next;
+    UCSRB |= (1 << UDRIE);
 }
 
 // Transmit a string
@@ -32,20 +63,62 @@ void uart_transmit_string(const char *str) {
     }
 }
 
+// Transmit a string stored in program memory
+void uart_transmit_string_P(const char *str) {
+    char ch;
+    while ((ch = pgm_read_byte(str++))) {
+        uart_transmit(ch);
+    }
+}
+
 // Check if a character is available
 char uart_available(void) {
-    return (UCSRA & (1 << RXC));
+    return rx_head != rx_tail;
 }
 
-// Receive a character
+// Receive a character, one must be available
 unsigned char uart_receive(void) {
-    return UDR;
+    uint8_t tail = rx_tail;
+    unsigned char data = rx_ring[tail];
+    rx_tail = (tail + 1) & (RX_RING_SIZE - 1);
+    return data;
 }
 
-// Receive a character
-unsigned char uart_receive_block(void) {
+// Wait, receive a character
+unsigned char uart_receive_blocking(void) {
     // Wait for data to be received
     while (!uart_available());
-    // Get and return received data from buffer
-    return UDR;
+    return uart_receive();
+}
+
+// Error flags are valid until UDR is read
+ISR(USART_RX_vect) {
+    uint8_t status = UCSRA;
+    uint8_t data = UDR;
+    if (status & (1 << FE)) {
+        uart_errors.frame++;
+        return;
+    }
+    if (status & (1 << DOR)) {
+        uart_errors.overrun++;  // a byte before this one is lost in hardware
+    }
+    uint8_t head = rx_head;
+    uint8_t next = (head + 1) & (RX_RING_SIZE - 1);
+    if (next != rx_tail) {
+        rx_ring[head] = data;
+        rx_head = next;
+    } else {
+        uart_errors.dropped++;
+    }
+}
+
+// Disables itself once the ring is empty, uart_transmit may enable it again after its last byte is taken
+ISR(USART_UDRE_vect) {
+    uint8_t tail = tx_tail;
+    if (tail == tx_head) {
+        UCSRB &= ~(1 << UDRIE);
+        return;
+    }
+    UDR = tx_ring[tail];
+    tx_tail = (tail + 1) & (TX_RING_SIZE - 1);
 }
@@ -5,15 +5,30 @@ Copyright (c) 2025 Arvid Juskaitis
 
 #pragma once
 
+#include <stdint.h>
+
+// Receive errors counted by the USART interrupt, see Stats_dump
+typedef struct {
+    uint16_t frame;     // stop bit missing, byte is dropped
+    uint16_t overrun;   // UDR was not read in time, bytes are lost in hardware
+    uint16_t dropped;   // RX ring was full
+} UartErrors_t;
+
+extern volatile UartErrors_t uart_errors;
+
 // Initialize UART
 void uart_init(unsigned int ubrr);
+// Change the rate, double_speed sets U2X
+void uart_set_rate(unsigned int ubrr, char double_speed);
 // Transmit a character
 void uart_transmit(unsigned char data);
 // Transmit a string
 void uart_transmit_string(const char *str);
+// Transmit a string stored in program memory
+void uart_transmit_string_P(const char *str);
 // Check if a character is available
 char uart_available(void);
-// Receive a character
+// Receive a character, one must be available
 unsigned char uart_receive(void);
 // Wait, receive a character
 unsigned char uart_receive_blocking(void);
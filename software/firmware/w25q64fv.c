@@ -14,17 +14,48 @@
  */
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "w25q64fv.h"
 #include "defs.h"
+#include "stats.h"
+#include "timer.h"
+#include "iostat.h"
 
 // Private functions
 W25Q64FV_status_t read_reg(uint8_t reg, uint8_t *buffer, unsigned int length);
 W25Q64FV_status_t write_reg(uint8_t reg, uint8_t *buffer, unsigned int length);
 W25Q64FV_status_t write_command(uint8_t command);
+void send_address(uint32_t address);
 void select_device();
 void release_device();
+void issued(uint8_t op);
+W25Q64FV_status_t wait_for(uint8_t op, unsigned long max_timeout_ms);
+#if FLASH_AUTODETECT
+W25Q64FV_status_t detect_geometry();
+#endif
 
 static int _cs;  ///< Chip select pin
+static uint8_t _pending_op = W25Q64FV_OP_NONE;  ///< Operation issued, not waited for yet
+static uint32_t _issued_at;                     ///< Timer_now() when the pending operation was issued
+/// Expected durations in timer ticks, typical values from the datasheet to start with
+static uint16_t _expected[W25Q64FV_OPS] = {
+  US_TO_TICKS(700),     // page program
+  US_TO_TICKS(100),     // a few bytes, e.g. CRC or flags
+  US_TO_TICKS(45000),   // 4K erase
+  US_TO_TICKS(120000),  // 32K erase
+  0xffff,               // chip erase takes 20s, saturated
+};
+/// Learned durations stay between a quarter of the typical value and the datasheet maximum
+static const uint16_t _limits[W25Q64FV_OPS][2] PROGMEM = {
+  { US_TO_TICKS(175),   US_TO_TICKS(3000) },      // page program, 3ms max
+  { US_TO_TICKS(25),    US_TO_TICKS(3000) },      // a few bytes, no longer than a page
+  { US_TO_TICKS(11250), US_TO_TICKS(400000) },    // 4K erase, 400ms max
+  { US_TO_TICKS(30000), US_TO_TICKS(1600000) },   // 32K erase, 1.6s max
+  { 0xffff,             0xffff },                 // chip erase
+};
+#if FLASH_AUTODETECT
+static uint8_t _capacity = W25Q64FV_CAPACITY_8MB;  ///< log2 of the flash size, JEDEC capacity code
+#endif
 
 
 W25Q64FV_status_t W25Q64FV_begin(uint8_t cs_pin) {
@@ -44,8 +75,19 @@ W25Q64FV_status_t W25Q64FV_begin(uint8_t cs_pin) {
   }
 
   // Reset the device
-  return W25Q64FV_reset();
+  W25Q64FV_status_t status = W25Q64FV_reset();
+#if FLASH_AUTODETECT
+  if (status == W25Q64FV_OK)
+    status = detect_geometry();
+#endif
+  return status;
+}
+
+#if FLASH_AUTODETECT
+uint32_t W25Q64FV_capacity() {
+  return 1UL << _capacity;
 }
+#endif
 
 #if WRITE || DELETE || BULK_TRANSFER
 W25Q64FV_status_t W25Q64FV_enable_writing() {
@@ -57,8 +99,8 @@ W25Q64FV_status_t W25Q64FV_enable_writing() {
   W25Q64FV_status_t status = write_command(W25Q64FV_INSTRUCTION_WRITE_ENABLE);
   if (status != W25Q64FV_OK)
     return status;
-  // wait until free
-  return W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+  // wait until free, an operation issued before is not waited for here
+  return wait_for(W25Q64FV_OP_NONE, W25Q64FV_DEFAULT_TIMEOUT);
 }
 #endif
 
@@ -78,7 +120,11 @@ W25Q64FV_status_t W25Q64FV_disable_writing() {
 
 #if WRITE || BULK_TRANSFER
 W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer) {
-  // write a single page to the flash chip
+  return W25Q64FV_write_bytes(start_address, buffer, 256);
+}
+
+W25Q64FV_status_t W25Q64FV_write_bytes(uint32_t start_address, byte *buffer, uint16_t size) {
+  // program up to a page, bytes must not cross the page boundary
   // check if busy
   if (W25Q64FV_busy())
     return W25Q64FV_BUSY;
@@ -87,14 +133,14 @@ W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer) {
   // write the page
   select_device();
   SPI.transfer(W25Q64FV_INSTRUCTION_PAGE_PROGRAM);
-  SPI.transfer(start_address >> 16);
-  SPI.transfer(start_address >> 8);
-  SPI.transfer(start_address);
-  for (int i = 0; i < 256; i++) {
+  send_address(start_address);
+  for (uint16_t i = 0; i < size; i++) {
     SPI.transfer(*buffer);
     *buffer++;
   }
   release_device();
+  IOSTAT_PROGRAM(size);
+  issued(size == 256 ? W25Q64FV_OP_PAGE_PROGRAM : W25Q64FV_OP_PROGRAM);
   return W25Q64FV_OK;
 }
 #endif
@@ -108,14 +154,13 @@ W25Q64FV_status_t W25Q64FV_read_page(uint32_t start_address, byte *buffer, uint1
   // read the page
   select_device();
   SPI.transfer(W25Q64FV_INSTRUCTION_READ_DATA);
-  SPI.transfer(start_address >> 16);
-  SPI.transfer(start_address >> 8);
-  SPI.transfer(start_address);
+  send_address(start_address);
   for (int i = 0; i < size; i++) {
     *buffer = SPI.transfer(0x00);
     *buffer++;
   }
   release_device();
+  IOSTAT_READ(size);
   return W25Q64FV_OK;
 }
 #endif
@@ -132,6 +177,8 @@ W25Q64FV_status_t W25Q64FV_erase_chip(bool hold) {
   W25Q64FV_status_t status = write_command(W25Q64FV_INSTRUCTION_CHIP_ERASE);
   if (status != W25Q64FV_OK)
     return status;
+  IOSTAT_ERASE();
+  issued(W25Q64FV_OP_ERASE_CHIP);
   // check for the hold
   if (hold)
     return W25Q64FV_wait_until_free(W25Q64FV_CHIP_ERASE_TIMEOUT);
@@ -147,13 +194,12 @@ W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t sector_address, bool hold){
     // check that writing is enables
     W25Q64FV_enable_writing();
     // write the command to erase
-    byte buffer[3];
-    buffer[0] = sector_address >> 16;
-    buffer[1] = sector_address >> 8;
-    buffer[2] = sector_address;
-    W25Q64FV_status_t status = write_reg(W25Q64FV_INSTRUCTION_BLOCK_32K_ERASE, buffer, 3);
-    if (status != W25Q64FV_OK)
-        return status;
+    select_device();
+    SPI.transfer(W25Q64FV_INSTRUCTION_BLOCK_32K_ERASE);
+    send_address(sector_address);
+    release_device();
+    IOSTAT_ERASE();
+    issued(W25Q64FV_OP_ERASE_32K);
     // check for a hold
     if (hold)
         return W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
@@ -161,7 +207,82 @@ W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t sector_address, bool hold){
 }
 #endif
 
-#if UNUSED
+#if DELETE
+W25Q64FV_status_t W25Q64FV_erase_sector_4k(uint32_t sector_address, bool hold){
+    // check if busy
+    if(W25Q64FV_busy())
+        return W25Q64FV_BUSY;
+    // check that writing is enables
+    W25Q64FV_enable_writing();
+    // write the command to erase
+    select_device();
+    SPI.transfer(W25Q64FV_INSTRUCTION_SECTOR_4K_ERASE);
+    send_address(sector_address);
+    release_device();
+    IOSTAT_ERASE();
+    issued(W25Q64FV_OP_ERASE_4K);
+    // check for a hold
+    if (hold)
+        return W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+    return W25Q64FV_OK;
+}
+#endif
+
+#if SNAPSHOT
+W25Q64FV_status_t W25Q64FV_read_security(uint32_t address, byte *buffer, uint16_t size) {
+  // check if busy
+  if (W25Q64FV_busy())
+    return W25Q64FV_BUSY;
+  select_device();
+  SPI.transfer(W25Q64FV_INSTRUCTION_READ_SECURITY_REGISTERS);
+  send_address(address);
+  SPI.transfer(0x00); // dummy byte
+  for (uint16_t i = 0; i < size; i++) {
+    *buffer++ = SPI.transfer(0x00);
+  }
+  release_device();
+  IOSTAT_READ(size);
+  return W25Q64FV_OK;
+}
+
+W25Q64FV_status_t W25Q64FV_program_security(uint32_t address, byte *buffer, uint16_t size) {
+  // check if busy
+  if (W25Q64FV_busy())
+    return W25Q64FV_BUSY;
+  // check that writing is enables
+  W25Q64FV_enable_writing();
+  select_device();
+  SPI.transfer(W25Q64FV_INSTRUCTION_PROGRAM_SECURITY_REGISTERS);
+  send_address(address);
+  for (uint16_t i = 0; i < size; i++) {
+    SPI.transfer(*buffer++);
+  }
+  release_device();
+  IOSTAT_PROGRAM(size);
+  issued(W25Q64FV_OP_PROGRAM);
+  return W25Q64FV_OK;
+}
+
+W25Q64FV_status_t W25Q64FV_erase_security(uint32_t address, bool hold) {
+  // check if busy
+  if (W25Q64FV_busy())
+    return W25Q64FV_BUSY;
+  // check that writing is enables
+  W25Q64FV_enable_writing();
+  select_device();
+  SPI.transfer(W25Q64FV_INSTRUCTION_ERASE_SECURITY_REGISTERS);
+  send_address(address);
+  release_device();
+  IOSTAT_ERASE();
+  issued(W25Q64FV_OP_ERASE_4K);   // takes as long as a sector erase
+  // check for a hold
+  if (hold)
+    return W25Q64FV_wait_until_free(W25Q64FV_DEFAULT_TIMEOUT);
+  return W25Q64FV_OK;
+}
+#endif
+
+#if FLASH_AUTODETECT || UNUSED
 W25Q64FV_status_t W25Q64FV_get_jedec(byte *manufacture_id, byte *memory_type, byte *capacity) {
   // read the jedec id and information
   // check if busy
@@ -185,29 +306,74 @@ bool W25Q64FV_busy() {
   SPI.transfer(W25Q64FV_INSTRUCTION_READ_STATUS_REGISTER_1);
   status = SPI.transfer(0);
   release_device();
+  IOSTAT_POLL();
   return (status & 0x01) != 0;
 }
 
 #define CYCLES_PER_MS (F_CPU / 1000UL)
+#define MIN_POLL_CYCLES US_TO_CYCLES(8)
+#define MAX_POLL_CYCLES US_TO_CYCLES(4000)
 W25Q64FV_status_t W25Q64FV_wait_until_free(unsigned long max_timeout_ms) {
-  unsigned long max_cycles = max_timeout_ms * CYCLES_PER_MS;
-  unsigned long elapsed_cycles = 0;
-  while (W25Q64FV_busy()) {
-    // Simulate a delay of 1 ms using a cycle-based delay
-    for (unsigned long i = 0; i < CYCLES_PER_MS / 4; i++) {
-      __asm__ __volatile__("nop"); // Each NOP takes 1 cycle
-    }
-    // Add 1 ms worth of cycles
-    elapsed_cycles += CYCLES_PER_MS;
+  uint8_t op = _pending_op;
+  _pending_op = W25Q64FV_OP_NONE;
+  return wait_for(op, max_timeout_ms);
+}
 
-    // Check if the timeout has been exceeded
-    if (elapsed_cycles >= max_cycles) {
+// Remembers the operation just issued, its duration is counted from now
+void issued(uint8_t op) {
+  _pending_op = op;
+  _issued_at = Timer_now();
+}
+
+// op is the operation in progress, W25Q64FV_OP_NONE for a register write
+W25Q64FV_status_t wait_for(uint8_t op, unsigned long max_timeout_ms) {
+  uint32_t waited_from = Timer_now();
+  uint32_t start = op < W25Q64FV_OPS ? _issued_at : waited_from;
+  uint32_t max_cycles = max_timeout_ms * CYCLES_PER_MS;
+  // First poll lands at the expected completion, later ones back off from 1/8 of it
+  uint32_t expected = op < W25Q64FV_OPS ? (uint32_t)_expected[op] * TIMER_TICK_CYCLES : 0;
+  uint32_t poll_at = expected;
+  uint32_t interval = expected / 8 > MIN_POLL_CYCLES ? expected / 8 : MIN_POLL_CYCLES;
+  uint32_t elapsed;
+  bool late = false;  // busy at the first poll
+  if (op < W25Q64FV_OPS) {
+    TRACE_EVENT(TR_FLASH, op);
+  }
+  while (1) {
+    while ((elapsed = Timer_now() - start) < poll_at);
+    if (!W25Q64FV_busy()) {
+      break;
+    }
+    late = true;
+    if (elapsed >= max_cycles) {
       return W25Q64FV_TIMEOUT;
     }
+    poll_at = elapsed + interval;
+    interval = interval < MAX_POLL_CYCLES / 2 ? interval * 2 : MAX_POLL_CYCLES;
+  }
+  // Found done long after the expected completion (the caller came back late), elapsed is not its duration
+  bool measured = op < W25Q64FV_OPS && (late || elapsed < expected + interval);
+  STATS_FLASH(measured ? op : W25Q64FV_OP_NONE, elapsed - (waited_from - start), elapsed);
+
+  if (op < W25Q64FV_OPS) {
+    TRACE_EVENT(TR_FLASH_END, op);
+  }
+  if (measured) {
+    // Done at the first poll means it could be sooner, so the average is pulled down a bit
+    uint32_t ticks = (late ? elapsed : expected - expected / 8) / TIMER_TICK_CYCLES;
+    int32_t delta = (int32_t)(ticks < 0xffff ? ticks : 0xffff) - _expected[op];
+    uint16_t value = _expected[op] + delta / 8;
+    uint16_t min = pgm_read_word(&_limits[op][0]);
+    uint16_t max = pgm_read_word(&_limits[op][1]);
+    _expected[op] = value < min ? min : value > max ? max : value;
   }
   return W25Q64FV_OK;
 }
 
+uint16_t W25Q64FV_expected(uint8_t op) {
+  return _expected[op];
+}
+
 W25Q64FV_status_t W25Q64FV_reset() {
   // reset the device
   // requires writing the reset enable followed by reset command to complete
@@ -270,6 +436,32 @@ W25Q64FV_status_t write_command(uint8_t command) {
   return W25Q64FV_OK;
 }
 
+#if FLASH_AUTODETECT
+W25Q64FV_status_t detect_geometry() {
+  byte manufacture_id, memory_type, capacity;
+  W25Q64FV_status_t status = W25Q64FV_get_jedec(&manufacture_id, &memory_type, &capacity);
+  if (status != W25Q64FV_OK)
+    return status;
+  // unknown parts are treated as W25Q64
+  if (capacity > W25Q64FV_CAPACITY_8MB && capacity <= W25Q64FV_CAPACITY_32MB)
+    _capacity = capacity;
+  // parts above 16 MB need 4-byte addresses, reset brings them back to 3-byte mode
+  if (_capacity > W25Q64FV_CAPACITY_16MB)
+    return write_command(W25Q64FV_INSTRUCTION_ENTER_4B_ADDRESS_MODE);
+  return W25Q64FV_OK;
+}
+#endif
+
+void send_address(uint32_t address) {
+#if FLASH_AUTODETECT
+  if (_capacity > W25Q64FV_CAPACITY_16MB)
+    SPI.transfer(address >> 24);
+#endif
+  SPI.transfer(address >> 16);
+  SPI.transfer(address >> 8);
+  SPI.transfer(address);
+}
+
 void select_device() {
   PORTB &= ~(1 << _cs); // CS low (select device)
 }
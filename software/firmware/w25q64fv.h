@@ -18,6 +18,7 @@
 #include <util/delay.h>
 #include <stdbool.h>
 #include "spi.h"
+#include "defs.h"
 
 
 /********** INSTRUCTION SETS **********/
@@ -48,6 +49,7 @@
 #define W25Q64FV_INSTRUCTION_ENABLE_QPI 0x38
 #define W25Q64FV_INSTRUCTION_ENABLE_RESET 0x66
 #define W25Q64FV_INSTRUCTION_RESET 0x99
+#define W25Q64FV_INSTRUCTION_ENTER_4B_ADDRESS_MODE 0xB7 // W25Q256 and larger
 // DUAL IO TABLE
 #define W25Q64FV_INSTRUCTION_FAST_READ_DUAL_OUTPUT 0x3B
 #define W25Q64FV_INSTRUCTION_FAST_READ_DUAL_IO 0xBB
@@ -69,6 +71,15 @@
   100000 // Chip erase timeout. Per spec, this is typically 20 seconds, at most
          // 100 seconds.
 
+/********** SECURITY REGISTERS, 1 to 3 **********/
+#define W25Q64FV_SECURITY_REGISTER(n) ((uint32_t)(n) << 12)
+#define W25Q64FV_SECURITY_REGISTER_SIZE 256
+
+/********** JEDEC CAPACITY CODES, log2 of size in bytes **********/
+#define W25Q64FV_CAPACITY_8MB  0x17 // W25Q64
+#define W25Q64FV_CAPACITY_16MB 0x18 // W25Q128
+#define W25Q64FV_CAPACITY_32MB 0x19 // W25Q256
+
 /// Default Status Return Enum
 typedef enum {
   W25Q64FV_OK = 0,             ///< Chip OK
@@ -78,6 +89,17 @@ typedef enum {
   W25Q64FV_NOT_VALID           ///< Not a valid operation
 } W25Q64FV_status_t;
 
+/// Operations with learned durations, W25Q64FV_wait_until_free polls near the expected completion
+typedef enum {
+  W25Q64FV_OP_PAGE_PROGRAM = 0, ///< Whole page
+  W25Q64FV_OP_PROGRAM,          ///< Part of a page
+  W25Q64FV_OP_ERASE_4K,
+  W25Q64FV_OP_ERASE_32K,
+  W25Q64FV_OP_ERASE_CHIP,
+  W25Q64FV_OPS,
+  W25Q64FV_OP_NONE = 0xff       ///< Register write, completes in a few us
+} W25Q64FV_op_t;
+
 
 typedef uint8_t byte;
 
@@ -92,6 +114,16 @@ typedef uint8_t byte;
  */
 W25Q64FV_status_t W25Q64FV_begin(uint8_t cs_pin);
 
+/**
+ * @brief Size of the flash chip
+ *
+ * Detected from JEDEC ID by W25Q64FV_begin, parts above 16 MB are switched to
+ * 4-byte addressing
+ *
+ * @return uint32_t             Size in bytes
+ */
+uint32_t W25Q64FV_capacity();
+
 /**
  * @brief Enable writing to the flash chip
  *
@@ -122,6 +154,19 @@ W25Q64FV_status_t W25Q64FV_disable_writing();
  */
 W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer);
 
+/**
+ * @brief Program bytes within a page
+ *
+ * Programs up to 256 bytes, only bits could be cleared. Bytes must not cross
+ * the page boundary, otherwise the address wraps within the page
+ *
+ * @param start_address         Start address to write to
+ * @param buffer                Buffer of data to write
+ * @param size                  Number of bytes to write
+ * @return W25Q64FV_status_t    Status return
+ */
+W25Q64FV_status_t W25Q64FV_write_bytes(uint32_t start_address, byte *buffer, uint16_t size);
+
 /**
  * @brief Read a page from the flash chip
  *
@@ -133,6 +178,17 @@ W25Q64FV_status_t W25Q64FV_write_page(uint32_t start_address, byte *buffer);
  */
 W25Q64FV_status_t W25Q64FV_read_page(uint32_t start_address, byte *buffer, const uint16_t size);
 
+/**
+ * @brief Erase a 4kB sector from the flash chip
+ *
+ * Erases a single sector of 4kB from the device. Address is truncated
+ *
+ * @param sector_address        Sector start address to erase
+ * @param hold                  Hold for the device to finish the erase
+ * @return W25Q64FV_status_t    Status return
+ */
+W25Q64FV_status_t W25Q64FV_erase_sector_4k(uint32_t sector_address, bool hold);
+
 /**
  * @brief Erase a 32kB block from the flash chip
  *
@@ -154,6 +210,40 @@ W25Q64FV_status_t W25Q64FV_erase_block_32(uint32_t block_address, bool hold);
  */
 W25Q64FV_status_t W25Q64FV_erase_chip(bool hold);
 
+/**
+ * @brief Read a security register
+ *
+ * Security registers are 256 bytes each, outside of the main array, chip erase
+ * leaves them as they are
+ *
+ * @param address               W25Q64FV_SECURITY_REGISTER(n) plus byte offset
+ * @param buffer                Buffer of data to read into
+ * @param size                  Number of bytes to read
+ * @return W25Q64FV_status_t    Status return
+ */
+W25Q64FV_status_t W25Q64FV_read_security(uint32_t address, byte *buffer, uint16_t size);
+
+/**
+ * @brief Program bytes of a security register
+ *
+ * Only bits could be cleared, register must not be locked
+ *
+ * @param address               W25Q64FV_SECURITY_REGISTER(n) plus byte offset
+ * @param buffer                Buffer of data to write
+ * @param size                  Number of bytes to write
+ * @return W25Q64FV_status_t    Status return
+ */
+W25Q64FV_status_t W25Q64FV_program_security(uint32_t address, byte *buffer, uint16_t size);
+
+/**
+ * @brief Erase a security register
+ *
+ * @param address               W25Q64FV_SECURITY_REGISTER(n)
+ * @param hold                  Hold for the device to finish the erase
+ * @return W25Q64FV_status_t    Status return
+ */
+W25Q64FV_status_t W25Q64FV_erase_security(uint32_t address, bool hold);
+
 /**
  * @brief Get the jedec object id
  *
@@ -175,9 +265,24 @@ bool W25Q64FV_busy();
 
 /**
  * @brief W25Q64FV_wait_until_free
+ *
+ * Waits for the last program or erase to complete. The first poll is timed to its
+ * expected duration since it was issued, later polls back off. Duration of the operation
+ * is learned within datasheet limits, unless it was found done long after completion
+ *
+ * @param max_timeout           Timeout in ms
+ * @return W25Q64FV_status_t    Status return
  */
 W25Q64FV_status_t  W25Q64FV_wait_until_free(unsigned long max_timeout);
 
+/**
+ * @brief Expected duration of an operation
+ *
+ * @param op                    W25Q64FV_op_t
+ * @return uint16_t             Duration in timer ticks, moving average of completed operations
+ */
+uint16_t W25Q64FV_expected(uint8_t op);
+
 /**
  * @brief Reset the flash chip
  *
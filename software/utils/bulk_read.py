@@ -9,14 +9,16 @@ import argparse
 import struct
 import time
 import os
+import uart_rate
 
 def main():
     # Argument parser for optional size and output file
     parser = argparse.ArgumentParser(description="Read binary data from serial and write to a file.")
     parser.add_argument("output_file", help="Path to the output file")
-    parser.add_argument("--blocks", type=int, default=0, help="Number of 32 kb blocks to read (default: 0 for unlimited)")
+    parser.add_argument("--blocks", type=int, default=0, help="Number of 32 kb blocks to read (default: 0 for the whole chip)")
     parser.add_argument("--port", default="/dev/ttyUSB1", help="Serial port (default: /dev/ttyUSB1)")
     parser.add_argument("--baudrate", type=int, default=250000, help="Baud rate (default: 250000)")
+    parser.add_argument("--rate", type=int, default=250000, help="Baud rate negotiated for the transfer, 500000 or 1000000 (default: 250000)")
     parser.add_argument("--timeout", type=float, default=None, help="Serial timeout in seconds (default: None for blocking mode)")
     args = parser.parse_args()
 
@@ -38,6 +40,8 @@ def main():
     else:
         print("No initial data received.")
 
+    uart_rate.negotiate(ser, args.rate)
+
     # Open the output file
     try:
         with open(args.output_file, "wb") as f:
@@ -46,16 +50,23 @@ def main():
             pages = args.blocks * 128
             print(f"Size in blocks: {args.blocks}, pages: {pages}")
 
-            # Prepare and send the "R" command with size
-            pages_pack = struct.pack("<H", pages)  # Little-endian 2-byte size
+            # Prepare and send the "R" command with size, 0 reads the whole chip
+            pages_pack = struct.pack("<I", pages)[:3]  # Little-endian 3-byte size
             ser.write(b"R" + pages_pack)
             print(f"Sent command 'R' {pages_pack}.")
 
-            time.sleep(3)
+            # Device answers with the number of pages it sends
+            count = ser.read(3)
+            if len(count) != 3:
+                print("Error: No page count received.")
+                return
+            pages = int.from_bytes(count, "little")
+            print(f"Pages to read: {pages}")
 
             # Read and write data in 256-byte chunks
-            bytes_to_read = pages * 256 if pages > 0 else float("inf")  # Unlimited if size is 0
+            bytes_to_read = pages * 256
             total_bytes_read = 0
+            start = time.time()
 
             while total_bytes_read < bytes_to_read:
                 chunk_size = min(256, bytes_to_read - total_bytes_read)
@@ -71,6 +82,8 @@ def main():
                 print(f"Read {len(data)} bytes, total {total_bytes_read} bytes.")
 
             print(f"Finished reading. Total bytes written: {total_bytes_read}.")
+            if total_bytes_read == bytes_to_read:
+                uart_rate.report(ser, total_bytes_read, time.time() - start)
 
     except IOError as e:
         print(f"Error writing to file: {e}")
@@ -9,6 +9,7 @@ import argparse
 import struct
 import time
 import os
+import uart_rate
 
 def main():
     # Argument parser for file and serial port configuration
@@ -17,6 +18,7 @@ def main():
     parser.add_argument("--offset", type=int, default=0, help="Offset in terms of 32 kb blocks to start writing from (default: 0). Note this number must match the first block in image file.")
     parser.add_argument("--port", default="/dev/ttyUSB1", help="Serial port (default: /dev/ttyUSB1)")
     parser.add_argument("--baudrate", type=int, default=250000, help="Baud rate (default: 250000)")
+    parser.add_argument("--rate", type=int, default=250000, help="Baud rate negotiated for the transfer, 500000 or 1000000 (default: 250000)")
     parser.add_argument("--timeout", type=float, default=5, help="Serial timeout in seconds (default: 5)")
     args = parser.parse_args()
 
@@ -48,12 +50,17 @@ def main():
     else:
         print("No initial data received.")
 
+    uart_rate.negotiate(ser, args.rate)
+
     # Open the input file
     try:
         file_size = os.path.getsize(args.input_file)
         if file_size % 256 != 0:
             print("Error: File size is not a multiple of 256 bytes.")
             return
+        if file_size == 0:
+            print("Error: File is empty, 0 pages would mean the whole chip.")
+            return
 
         with open(args.input_file, "rb") as f:
             print(f"Input file {args.input_file} opened. Size: {file_size} bytes.")
@@ -64,10 +71,11 @@ def main():
             print(f"Number of blocks: {blocks}, pages to send: {pages}")
 
             # Send the "W" command with the offs, size
-            offs_pack = struct.pack("<H", offs) # Little-endian 2-byte offs
-            pages_pack = struct.pack("<H", pages)  # Little-endian 2-byte size
+            offs_pack = struct.pack("<I", offs)[:3] # Little-endian 3-byte offs
+            pages_pack = struct.pack("<I", pages)[:3]  # Little-endian 3-byte size
             ser.write(b"W" + offs_pack + pages_pack)
             print(f"Sent command 'W' {offs_pack}, {pages_pack}.")
+            start = time.time()
 
             # Stream the content page by page
             for page in range(pages):
@@ -96,6 +104,7 @@ def main():
                     return
 
             print("Transmission completed successfully.")
+            uart_rate.report(ser, file_size, time.time() - start)
 
     except IOError as e:
         print(f"Error reading the file: {e}")
@@ -0,0 +1,174 @@
+#!/usr/bin/python3
+
+#########################################################
+# Protocol trace decoder for Flash Disk storage device
+# Copyright (c) 2025 Arvid Juskaitis
+#
+# Firmware built with TRACE dumps the last bus events on 't' command.
+# Every byte from CPU is shown as a line, its time is split into phases:
+#   isr    - INT0 until strobe started
+#   strobe - CLEWRITE- pulse, latch is released after it
+#   queue  - byte waits in the event ring for the main loop
+#   mcu    - main loop handles the byte until the reply, flash excluded
+#   flash  - waiting for flash to complete program or erase
+#   cpu    - reply is out, waiting for the next byte from CPU
+
+import argparse
+import time
+import sys
+
+TR_IN = 0x1
+TR_RELEASE = 0x2
+TR_TAKE = 0x3
+TR_OUT = 0x4
+TR_FLASH = 0x5
+TR_FLASH_END = 0x6
+
+STATES = ["IDLE", "RECV_CMD", "PROCESS", "SEND", "RECV_DATA", "FINISH"]
+COMMANDS = ["RESET", "LIST", "READ", "WRITE", "DELETE", "READ_RANGE", "UPDATE",
+            "OPEN", "READ_NEXT", "SEEK", "CLOSE", "STATS"]
+MARKERS = {0x80: "BODT", 0x8F: "EODT", 0xA0: "ACK", 0xAF: "NACK", 0x40: "BSY", 0x00: "-"}
+PHASES = ["isr", "strobe", "queue", "mcu", "flash", "cpu"]
+
+def byte_name(value, from_cpu):
+    if value & 0x10:
+        return f"DAT:{value & 0x0f:X}"
+    if from_cpu and value < len(COMMANDS):
+        return COMMANDS[value]
+    return MARKERS.get(value, f"0x{value:02X}")
+
+def state_name(kind):
+    state = kind & 0x0f
+    return STATES[state] if state < len(STATES) else str(state)
+
+def read_dump(lines):
+    # header "trace f_cpu=N tick=N strobe=N", then "KKDDTTTTTT" lines until "end"
+    header = None
+    entries = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("trace "):
+            header = dict(kv.split("=") for kv in line.split()[1:])
+            entries = []
+        elif line == "end" and header:
+            break
+        elif header and len(line) == 10:
+            entries.append((int(line[0:2], 16), int(line[2:4], 16), int(line[4:10], 16)))
+    if not header:
+        raise ValueError("trace header is not found")
+    return {k: int(v) for k, v in header.items()}, entries
+
+def unwrap(entries, tick):
+    # 24-bit time wraps, entries are in order
+    result = []
+    base = 0
+    last = None
+    for kind, data, t in entries:
+        if last is not None and t < last:
+            base += 1 << 24
+        last = t
+        result.append((kind, data, (base + t) * tick))
+    return result
+
+def group_bytes(entries):
+    # a byte starts with TR_IN, everything until the next TR_IN belongs to it
+    groups = []
+    for kind, data, cycles in entries:
+        k = kind >> 4
+        if k == TR_IN:
+            groups.append({"in": (kind, data, cycles), "events": []})
+        elif groups:
+            groups[-1]["events"].append((k, kind, data, cycles))
+    return groups
+
+def phases(group, next_in, strobe):
+    _, _, t_in = group["in"]
+    p = dict.fromkeys(PHASES, 0)
+    t_released = t_take = t_out = t_flash = None
+    out = None
+    for k, kind, data, cycles in group["events"]:
+        if k == TR_RELEASE:
+            p["isr"] = data
+            p["strobe"] = strobe
+            t_released = t_in + data + strobe
+        elif k == TR_TAKE:
+            t_take = cycles
+        elif k == TR_FLASH:
+            t_flash = cycles
+        elif k == TR_FLASH_END and t_flash is not None:
+            p["flash"] += cycles - t_flash
+            t_flash = None
+        elif k == TR_OUT and out is None:
+            t_out = cycles
+            out = (kind, data)
+    if t_take is not None and t_released is not None:
+        p["queue"] = max(0, t_take - t_released)
+    if t_take is not None and t_out is not None:
+        p["mcu"] = max(0, t_out - t_take - p["flash"])
+    if t_out is not None and next_in is not None:
+        p["cpu"] = max(0, next_in - t_out)
+    return p, out
+
+def main():
+    parser = argparse.ArgumentParser(description="Request protocol trace from the device and print a per-byte timeline.")
+    parser.add_argument("--input", help="Decode a saved dump instead of requesting it over serial port")
+    parser.add_argument("--port", default="/dev/ttyUSB1", help="Serial port (default: /dev/ttyUSB1)")
+    parser.add_argument("--baudrate", type=int, default=250000, help="Baud rate (default: 250000)")
+    parser.add_argument("--timeout", type=float, default=2, help="Serial timeout in seconds (default: 2)")
+    args = parser.parse_args()
+
+    if args.input:
+        with open(args.input) as f:
+            lines = f.readlines()
+    else:
+        import serial   # not needed to decode a saved dump
+        try:
+            ser = serial.Serial(port=args.port, baudrate=args.baudrate, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE, timeout=args.timeout)
+        except serial.SerialException as e:
+            print(f"Error opening serial port: {e}")
+            return 1
+        time.sleep(3)
+        ser.read_all()  # drop initial output
+        ser.write(b"t")
+        lines = []
+        while True:
+            line = ser.readline().decode("ascii", errors="replace")
+            if not line:
+                break
+            lines.append(line)
+            if line.strip() == "end":
+                break
+        ser.close()
+
+    try:
+        header, entries = read_dump(lines)
+    except ValueError as e:
+        print(f"Error: {e}")
+        return 1
+    us = 1000000.0 / header["f_cpu"]
+    groups = group_bytes(unwrap(entries, header["tick"]))
+    if not groups:
+        print("No bytes recorded.")
+        return 0
+
+    t0 = groups[0]["in"][2]
+    totals = dict.fromkeys(PHASES, 0)
+    print(f"{'time_us':>10} {'state':<10} {'in':<10} {'out':<10}" + "".join(f"{p:>8}" for p in PHASES))
+    for i, group in enumerate(groups):
+        kind, data, t_in = group["in"]
+        next_in = groups[i + 1]["in"][2] if i + 1 < len(groups) else None
+        p, out = phases(group, next_in, header["strobe"])
+        for name in PHASES:
+            totals[name] += p[name]
+        out_name = byte_name(out[1], False) if out else "?"
+        print(f"{(t_in - t0) * us:>10.0f} {state_name(kind):<10} {byte_name(data, True):<10} {out_name:<10}"
+              + "".join(f"{p[name] * us:>8.0f}" for name in PHASES))
+
+    total = sum(totals.values()) or 1
+    print(f"{'total_us':>10} {'':<10} {'':<10} {'':<10}" + "".join(f"{totals[name] * us:>8.0f}" for name in PHASES))
+    print(f"{'share %':>10} {'':<10} {'':<10} {'':<10}" + "".join(f"{100.0 * totals[name] / total:>8.1f}" for name in PHASES))
+    print("Times are multiples of the trace tick, except isr and strobe which are exact.")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
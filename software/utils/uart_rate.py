@@ -0,0 +1,60 @@
+#########################################################
+# Bulk operations utility for Flash Disk storage device
+# Copyright (c) 2025 Arvid Juskaitis
+#
+# Rate negotiation for bulk transfers, see 'U' in RC6502-flash-protocol.md
+
+import time
+
+F_CPU = 8000000
+SAFE_RATE = 250000
+ACK = 0xA0
+PROBE = bytes([0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC])
+
+def negotiate(ser, rate):
+    """Switches MCU and port to rate, returns the rate in use afterwards."""
+    if rate == SAFE_RATE:
+        return rate
+    ubrr = F_CPU // 8 // rate - 1
+    if ubrr < 0 or ubrr > 255 or F_CPU // 8 // (ubrr + 1) != rate:
+        print(f"Rate {rate} cannot be set exactly, staying at {SAFE_RATE}.")
+        return SAFE_RATE
+
+    timeout = ser.timeout
+    ser.timeout = 0.5   # MCU waits up to 1 s for every byte
+    try:
+        ser.write(b"U" + bytes([ubrr]))
+        if ser.read(1) != bytes([ACK]):
+            print(f"Rate change is not acknowledged, staying at {SAFE_RATE}.")
+            return SAFE_RATE
+
+        ser.baudrate = rate
+        ser.write(PROBE)
+        echo = ser.read(len(PROBE))
+        if echo == PROBE:
+            ser.write(bytes([ACK]))
+            if ser.read(1) == bytes([ACK]):
+                print(f"Rate switched to {rate} baud.")
+                return rate
+    finally:
+        ser.timeout = timeout
+
+    # MCU falls back once a byte of the handshake is missing or wrong
+    print(f"Rate {rate} failed, back to {SAFE_RATE}.")
+    ser.baudrate = SAFE_RATE
+    time.sleep(1.1)
+    ser.reset_input_buffer()
+    return SAFE_RATE
+
+def report(ser, nbytes, seconds):
+    """Prints host throughput and the line MCU sends after the transfer."""
+    if seconds > 0:
+        print(f"Host: {nbytes} bytes in {seconds:.1f} s, {nbytes / seconds:.0f} B/s.")
+    line = ser.readline().decode('utf-8', errors='replace').strip()
+    if line.startswith("bulk "):
+        fields = dict(f.split("=") for f in line.split()[1:])
+        us = int(fields["us"])
+        rate = int(fields["bytes"]) * 1000000 / us if us else 0
+        print(f"MCU: {line}, {rate:.0f} B/s on the wire.")
+    elif line:
+        print(f"MCU: {line}")